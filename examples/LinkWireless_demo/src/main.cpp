@@ -7,6 +7,9 @@
 // (0) Include the header
 #include "../../../lib/LinkWireless.hpp"
 
+// Show profiler (uncomment to enable)
+// #define PROFILING_ENABLED
+
 #ifdef PROFILING_ENABLED
 #include <regex>
 #endif
@@ -29,6 +32,9 @@ void log(std::string text);
 void waitFor(u16 key);
 void wait(u32 verticalLines);
 void hang();
+#ifdef PROFILING_ENABLED
+std::string profilerStats(LinkWireless::ProfilerStats& stats);
+#endif
 
 LinkWireless::Error lastError;
 LinkWireless* linkWireless = NULL;
@@ -84,6 +90,10 @@ start:
 
   // (3) Initialize the library
   linkWireless->activate();
+#ifdef PROFILING_ENABLED
+  // (uses timers 1 and 2)
+  linkWireless->activateProfiler(1);
+#endif
 
   bool activating = false;
   bool serving = false;
@@ -402,25 +412,18 @@ void messageLoop() {
     }
     if (altView) {
 #ifdef PROFILING_ENABLED
-      output += "\n_onVBlank: " + std::to_string(linkWireless->lastVBlankTime);
-      output += "\n_onSerial: " + std::to_string(linkWireless->lastSerialTime);
-      output += "\n_onTimer: " + std::to_string(linkWireless->lastTimerTime);
-      if (asyncACK)
-        output += " | " + std::to_string(linkWireless->lastACKTimerTime);
-      output +=
-          "\n_serialIRQs: " + std::to_string(linkWireless->lastFrameSerialIRQs);
-      output +=
-          "\n_timerIRQs: " + std::to_string(linkWireless->lastFrameTimerIRQs);
+      auto& profiler = linkWireless->profiler;
+      output += "\n_onVBlank: " + profilerStats(profiler.vBlank);
+      output += "\n_onSerial: " + profilerStats(profiler.serial);
+      output += "\n_onTimer: " + profilerStats(profiler.timer);
       if (asyncACK)
-        output += " | " + std::to_string(linkWireless->lastFrameACKTimerIRQs);
-      output +=
-          "\n_ms: " +
-          std::to_string(linkWireless->toMs(
-              linkWireless->lastVBlankTime +
-              linkWireless->lastSerialTime * linkWireless->lastFrameSerialIRQs +
-              linkWireless->lastTimerTime * linkWireless->lastFrameTimerIRQs +
-              linkWireless->lastACKTimerTime *
-                  linkWireless->lastFrameACKTimerIRQs));
+        output += "\n_onACKTimer: " + profilerStats(profiler.ackTimer);
+      output += "\n_sendData: " + profilerStats(profiler.sendData);
+      output += "\n_receiveData: " + profilerStats(profiler.receiveData);
+      output += "\n_frame: " + std::to_string(profiler.lastFrameUsage()) +
+                "% [max " + std::to_string(profiler.maxFrameUsage()) + "%]";
+      output += "\n_ms: " + std::to_string(linkWireless->toMs(
+                                 profiler.lastFrameCycles));
 #endif
 #ifndef PROFILING_ENABLED
       if (lostPackets > 0) {
@@ -470,4 +473,11 @@ void wait(u32 verticalLines) {
 
 void hang() {
   waitFor(KEY_DOWN);
-}
\ No newline at end of file
+}
+
+#ifdef PROFILING_ENABLED
+std::string profilerStats(LinkWireless::ProfilerStats& stats) {
+  return std::to_string(stats.mean()) + " [max " + std::to_string(stats.max) +
+         "]";
+}
+#endif
@@ -95,13 +95,13 @@ cd ..
 
 cd LinkWireless_demo/
 sed -i -e "s/\/\/ #define LINK_WIRELESS_PUT_ISR_IN_IWRAM/#define LINK_WIRELESS_PUT_ISR_IN_IWRAM/g" ../../lib/LinkWireless.hpp
-sed -i -e "s/\/\/ #define PROFILING_ENABLED/#define PROFILING_ENABLED/g" ../../lib/LinkWireless.hpp
+sed -i -e "s/\/\/ #define PROFILING_ENABLED/#define PROFILING_ENABLED/g" src/main.cpp
 mv LinkWireless_demo.gba backup.gba
 make rebuild
 cp LinkWireless_demo.gba ../LinkWireless_demo_profiler.gba
 mv backup.gba LinkWireless_demo.gba
 sed -i -e "s/#define LINK_WIRELESS_PUT_ISR_IN_IWRAM/\/\/ #define LINK_WIRELESS_PUT_ISR_IN_IWRAM/g" ../../lib/LinkWireless.hpp
-sed -i -e "s/#define PROFILING_ENABLED/\/\/ #define PROFILING_ENABLED/g" ../../lib/LinkWireless.hpp
+sed -i -e "s/#define PROFILING_ENABLED/\/\/ #define PROFILING_ENABLED/g" src/main.cpp
 cd ..
 
 cd LinkWirelessMultiboot_demo/
@@ -39,6 +39,7 @@
 // `send(...)` restrictions:
 // - 0xFFFF and 0x0 are reserved values, so don't send them!
 //   (they mean 'disconnected' and 'no data' respectively)
+// - If `config.clockSync` is enabled, 0xFFFE is also reserved.
 // --------------------------------------------------------------------------
 
 #include <tonc_bios.h>
@@ -56,6 +57,12 @@
 #define LINK_CABLE_DEFAULT_SEND_TIMER_ID 3
 #define LINK_CABLE_BASE_FREQUENCY TM_FREQ_1024
 #define LINK_CABLE_REMOTE_TIMEOUT_OFFLINE -1
+#define LINK_CABLE_CLOCK_SYNC 0xfffe
+#define LINK_CABLE_CLOCK_SYNC_INTERVAL_FRAMES 60
+#define LINK_CABLE_CLOCK_SYNC_WORDS 3
+#define LINK_CABLE_CLOCK_SYNC_WORD_BITS 11
+#define LINK_CABLE_CLOCK_SYNC_WORD_FLAG 0x4000
+#define LINK_CABLE_LINES_PER_FRAME 228
 #define LINK_CABLE_BIT_SLAVE 2
 #define LINK_CABLE_BIT_READY 3
 #define LINK_CABLE_BITS_PLAYER_ID 4
@@ -150,6 +157,8 @@ class LinkCable {
 
     reset();
     clearIncomingMessages();
+    clock.sync = ClockSync{};
+    didTransfer = false;
 
     LINK_CABLE_BARRIER;
     isEnabled = true;
@@ -173,6 +182,12 @@ class LinkCable {
   u8 playerCount() { return state.playerCount; }
   u8 currentPlayerId() { return state.currentPlayerId; }
 
+  bool isCablePlugged() {
+    // (in Multi-Play mode, the master's end of the cable grounds SI, but SI
+    // alone isn't reliable without a cable, so a transfer must have completed)
+    return isEnabled && (isConnected() || (isMaster() && didTransfer));
+  }
+
   void sync() {
     if (!isEnabled)
       return;
@@ -216,8 +231,11 @@ class LinkCable {
 
   u16 peek(u8 playerId) { return state.incomingMessages[playerId].peek(); }
 
+  bool canSend() { return !_state.outgoingMessages.isFull(); }
+
   void send(u16 data) {
-    if (data == LINK_CABLE_DISCONNECTED || data == LINK_CABLE_NO_DATA)
+    if (data == LINK_CABLE_DISCONNECTED || data == LINK_CABLE_NO_DATA ||
+        (config.clockSync && data == LINK_CABLE_CLOCK_SYNC))
       return;
 
     LINK_CABLE_BARRIER;
@@ -236,7 +254,52 @@ class LinkCable {
     }
   }
 
+  struct ClockSync {
+    s32 offset = 0;  // (lines to add to the local time)
+    s32 drift = 0;   // (in ppm)
+    u32 delay = 0;   // (always 0, as all consoles see the same transfer)
+    u32 samples = 0;
+  };
+
+  u32 getLocalTime() {
+    // (vertical lines since the first VBlank; VBlank starts at line 160)
+    u32 frames, vCount;
+    bool isVBlankPending;
+    do {
+      frames = frameCount;
+      vCount = REG_VCOUNT;
+      isVBlankPending = (REG_IE & IRQ_VBLANK) && (REG_IF & IRQ_VBLANK);
+    } while (frames != frameCount);
+
+    // (between line 160 and the VBlank handler, `frameCount` is one behind)
+    if (vCount >= 160 && isVBlankPending)
+      frames++;
+
+    return frames * LINK_CABLE_LINES_PER_FRAME +
+           (vCount + LINK_CABLE_LINES_PER_FRAME - 160) %
+               LINK_CABLE_LINES_PER_FRAME;
+  }
+
+  u32 getSharedTime() {
+    u32 localTime = getLocalTime();
+    if (state.currentPlayerId == 0 || clock.sync.samples == 0)
+      return localTime;
+
+    s32 elapsed = localTime - clock.lastSampleTime;
+    return localTime + clock.sync.offset +
+           (s32)(((s64)clock.sync.drift * elapsed) / 1000000);
+  }
+
+  bool isClockSynced() {
+    return isConnected() &&
+           (state.currentPlayerId == 0 || clock.sync.samples > 0);
+  }
+
+  ClockSync getClockSync() { return clock.sync; }
+
   void _onVBlank() {
+    frameCount++;
+
     if (!isEnabled)
       return;
 
@@ -259,12 +322,15 @@ class LinkCable {
 
     _state.IRQFlag = true;
     _state.IRQTimeout = 0;
+    didTransfer = true;
 
     u8 newPlayerCount = 0;
     for (u32 i = 0; i < LINK_CABLE_MAX_PLAYERS; i++) {
       u16 data = REG_SIOMULTI[i];
 
       if (data != LINK_CABLE_DISCONNECTED) {
+        if (i == 0 && config.clockSync && handleClockSyncData(data))
+          data = LINK_CABLE_NO_DATA;
         if (data != LINK_CABLE_NO_DATA && i != state.currentPlayerId)
           _state.newMessages[i].push(data);
         newPlayerCount++;
@@ -313,6 +379,7 @@ class LinkCable {
     u32 remoteTimeout;
     u32 interval;
     u8 sendTimerId;
+    bool clockSync = false;
   };
 
   Config config;
@@ -333,12 +400,25 @@ class LinkCable {
     u32 IRQTimeout;
   };
 
+  struct ClockSyncState {
+    ClockSync sync;
+    s32 lastSample = 0;
+    u32 lastSampleTime = 0;
+    u32 lastSyncFrame = 0;
+    u32 syncTime = 0;
+    u32 masterTime = 0;
+    u32 pendingWords = 0;
+  };
+
   ExternalState state;
   InternalState _state;
+  ClockSyncState clock;
+  vu32 frameCount = 0;
   volatile bool isEnabled = false;
   volatile bool isReadingMessages = false;
   volatile bool isAddingMessage = false;
   volatile bool isAddingWhileResetting = false;
+  volatile bool didTransfer = false;
 
   bool isMaster() { return !isBitHigh(LINK_CABLE_BIT_SLAVE); }
   bool isReady() { return isBitHigh(LINK_CABLE_BIT_READY); }
@@ -347,6 +427,9 @@ class LinkCable {
   bool didTimeout() { return _state.IRQTimeout >= config.timeout; }
 
   void sendPendingData() {
+    if (config.clockSync && isMaster() && sendClockSyncData())
+      return;
+
     if (isAddingMessage)
       return;
 
@@ -355,6 +438,69 @@ class LinkCable {
     transfer(_state.outgoingMessages.pop());
   }
 
+  bool sendClockSyncData() {
+    // the master sends a sync mark every second, and all consoles take their
+    // local time when it arrives (as the transfer is seen by all of them at the
+    // same time); then, it sends the time it took in the next transfers
+    if (clock.pendingWords > 0) {
+      u32 word = LINK_CABLE_CLOCK_SYNC_WORDS - clock.pendingWords;
+      u32 bits = (clock.syncTime >> (word * LINK_CABLE_CLOCK_SYNC_WORD_BITS)) &
+                 ((1 << LINK_CABLE_CLOCK_SYNC_WORD_BITS) - 1);
+      transfer(LINK_CABLE_CLOCK_SYNC_WORD_FLAG | bits);
+      return true;
+    }
+
+    if (frameCount - clock.lastSyncFrame >=
+        LINK_CABLE_CLOCK_SYNC_INTERVAL_FRAMES) {
+      clock.lastSyncFrame = frameCount;
+      transfer(LINK_CABLE_CLOCK_SYNC);
+      return true;
+    }
+
+    return false;
+  }
+
+  bool handleClockSyncData(u16 data) {
+    if (data == LINK_CABLE_CLOCK_SYNC) {
+      clock.syncTime = getLocalTime();
+      clock.masterTime = 0;
+      clock.pendingWords = LINK_CABLE_CLOCK_SYNC_WORDS;
+      return true;
+    }
+    if (clock.pendingWords == 0)
+      return false;
+
+    u32 word = LINK_CABLE_CLOCK_SYNC_WORDS - clock.pendingWords;
+    u32 bits = data & ((1 << LINK_CABLE_CLOCK_SYNC_WORD_BITS) - 1);
+    clock.masterTime |= bits << (word * LINK_CABLE_CLOCK_SYNC_WORD_BITS);
+    clock.pendingWords--;
+
+    if (clock.pendingWords == 0 && state.currentPlayerId != 0)
+      addClockSample((s32)(clock.masterTime - clock.syncTime), clock.syncTime);
+
+    return true;
+  }
+
+  void addClockSample(s32 sample, u32 time) {
+    auto& sync = clock.sync;
+
+    if (sync.samples == 0) {
+      sync.offset = sample;
+    } else {
+      s32 elapsed = time - clock.lastSampleTime;
+      if (elapsed > 0) {
+        s32 drift =
+            (s32)(((s64)(sample - clock.lastSample) * 1000000) / elapsed);
+        sync.drift += (drift - sync.drift) / 8;
+      }
+      sync.offset += (sample - sync.offset) / 4;
+    }
+
+    sync.samples++;
+    clock.lastSample = sample;
+    clock.lastSampleTime = time;
+  }
+
   void transfer(u16 data) {
     REG_SIOMLT_SEND = data;
 
@@ -386,6 +532,7 @@ class LinkCable {
     }
     _state.IRQFlag = false;
     _state.IRQTimeout = 0;
+    clock.pendingWords = 0;
   }
 
   void stop() {
@@ -184,11 +184,18 @@ class LinkCableMultiboot {
   PartialResult sendHeader(const u8* rom, F cancel) {
     u16* headerOut = (u16*)rom;
 
+    // (the header words are chained back-to-back, refilling the queue as it
+    // drains; the responses are not needed, so they aren't stored)
     for (int i = 0; i < LINK_CABLE_MULTIBOOT_HEADER_SIZE; i += 2) {
-      linkRawCable->transfer(*(headerOut++), cancel);
-      if (cancel())
-        return ABORTED;
+      // (polling, so the game's serial interrupt handler isn't triggered)
+      while (!linkRawCable->queueTransferAsync(*headerOut, false, false)) {
+        if (!linkRawCable->waitQueue(cancel, LINK_RAW_CABLE_QUEUE_SIZE))
+          return ABORTED;
+      }
+      headerOut++;
     }
+    if (!linkRawCable->waitQueue(cancel))
+      return ABORTED;
 
     return FINISHED;
   }
@@ -28,6 +28,16 @@
 //         u16 data = linkRawCable->getAsyncData();
 //         // ...
 //       }
+// - 7) Queue multiple transfers, chained by the interrupt handler:
+//       linkRawCable->queueTransferAsync(0x1234);
+//       linkRawCable->queueTransferAsync(0x5678);
+//       // ...
+//       while (linkRawCable->canReadResponse()) {
+//         LinkRawCable::Response response = linkRawCable->readResponse();
+//         // ...
+//       }
+//       // (with `queueTransferAsync(data, false)`, no serial interrupts are
+//       // raised, and transfers are only chained from `waitQueue(...)`)
 // --------------------------------------------------------------------------
 // considerations:
 // - don't send 0xFFFF, it's a reserved value that means <disconnected client>
@@ -36,6 +46,9 @@
 
 #include <tonc_core.h>
 
+// Queue size (pending transfers and unread responses, use a power of 2)
+#define LINK_RAW_CABLE_QUEUE_SIZE 32
+
 #define LINK_RAW_CABLE_MAX_PLAYERS 4
 #define LINK_RAW_CABLE_DISCONNECTED 0xffff
 #define LINK_RAW_CABLE_BIT_SLAVE 2
@@ -77,6 +90,7 @@ class LinkRawCable {
     this->baudRate = baudRate;
     this->asyncState = IDLE;
     this->asyncData = LINK_RAW_CABLE_EMPTY_RESPONSE;
+    resetQueue();
 
     setMultiPlayMode();
     isEnabled = true;
@@ -89,6 +103,7 @@ class LinkRawCable {
     baudRate = BaudRate::BAUD_RATE_1;
     asyncState = IDLE;
     asyncData = LINK_RAW_CABLE_EMPTY_RESPONSE;
+    resetQueue();
   }
 
   Response transfer(u16 data) {
@@ -140,6 +155,80 @@ class LinkRawCable {
     return data;
   }
 
+  bool queueTransferAsync(u16 data,
+                          bool useInterrupts = true,
+                          bool storeResponse = true) {
+    if (!isEnabled || (asyncState != IDLE && !isQueueActive) ||
+        outgoingTail - outgoingHead == LINK_RAW_CABLE_QUEUE_SIZE)
+      return false;
+
+    outgoing[outgoingTail % LINK_RAW_CABLE_QUEUE_SIZE] = data;
+    outgoingStoresResponse[outgoingTail % LINK_RAW_CABLE_QUEUE_SIZE] =
+        storeResponse;
+
+    // (the interrupt handler can't finish the queue while adding the item)
+    u16 ime = REG_IME;
+    REG_IME = 0;
+    outgoingTail++;
+    if (!isQueueActive) {
+      isQueueActive = true;
+      isQueuePolling = !useInterrupts;
+      startQueuedTransfer();
+    }
+    REG_IME = ime;
+
+    return true;
+  }
+
+  template <typename F>
+  bool waitQueue(F cancel, u32 maxPendingTransfers = 0) {
+    while (getPendingTransfers() > maxPendingTransfers) {
+      if (cancel()) {
+        stopQueue();
+        return false;
+      }
+
+      // (if there's no interrupt handler, transfers are chained from here)
+      u16 ime = REG_IME;
+      REG_IME = 0;
+      if (isQueueActive && !isSending())
+        continueQueue();
+      REG_IME = ime;
+    }
+
+    return true;
+  }
+
+  void stopQueue() {
+    u16 ime = REG_IME;
+    REG_IME = 0;
+    if (isQueueActive) {
+      stopTransfer();
+      setInterruptsOff();
+      outgoingHead = outgoingTail;
+      isQueueActive = false;
+      asyncState = IDLE;
+    }
+    REG_IME = ime;
+  }
+
+  bool isQueueBusy() { return isQueueActive; }
+  u32 getPendingTransfers() {
+    return outgoingTail - outgoingHead + (isQueueActive ? 1 : 0);
+  }
+  bool canReadResponse() { return responsesTail != responsesHead; }
+
+  Response readResponse() {
+    if (!canReadResponse())
+      return LINK_RAW_CABLE_EMPTY_RESPONSE;
+
+    Response response = responses[responsesHead % LINK_RAW_CABLE_QUEUE_SIZE];
+    responsesHead++;
+    return response;
+  }
+
+  u32 getDroppedResponses() { return droppedResponses; }
+
   BaudRate getBaudRate() { return baudRate; }
   bool isMaster() { return !isBitHigh(LINK_RAW_CABLE_BIT_SLAVE); }
   bool isReady() { return isBitHigh(LINK_RAW_CABLE_BIT_READY); }
@@ -149,6 +238,12 @@ class LinkRawCable {
     if (!isEnabled || asyncState != WAITING)
       return;
 
+    if (isQueueActive) {
+      if (!isSending() && !isQueuePolling)
+        continueQueue();
+      return;
+    }
+
     setInterruptsOff();
     asyncState = READY;
     asyncData = LINK_RAW_CABLE_EMPTY_RESPONSE;
@@ -160,8 +255,66 @@ class LinkRawCable {
   BaudRate baudRate = BaudRate::BAUD_RATE_1;
   AsyncState asyncState = IDLE;
   Response asyncData = LINK_RAW_CABLE_EMPTY_RESPONSE;
+  u16 outgoing[LINK_RAW_CABLE_QUEUE_SIZE];
+  bool outgoingStoresResponse[LINK_RAW_CABLE_QUEUE_SIZE];
+  volatile u32 outgoingHead = 0;
+  volatile u32 outgoingTail = 0;
+  Response responses[LINK_RAW_CABLE_QUEUE_SIZE];
+  volatile u32 responsesHead = 0;
+  volatile u32 responsesTail = 0;
+  volatile u32 droppedResponses = 0;
+  volatile bool isQueueActive = false;
+  volatile bool isQueuePolling = false;
+  volatile bool isStoringResponse = false;
   volatile bool isEnabled = false;
 
+  void continueQueue() {
+    Response response = LINK_RAW_CABLE_EMPTY_RESPONSE;
+    bool shouldStore = isStoringResponse;
+    if (shouldStore && isReady() && !hasError())
+      response = getData();
+
+    // (the next transfer starts right away, before storing the response)
+    if (outgoingTail != outgoingHead) {
+      startQueuedTransfer();
+    } else {
+      setInterruptsOff();
+      isQueueActive = false;
+      asyncState = IDLE;
+    }
+
+    if (!shouldStore)
+      return;
+    if (responsesTail - responsesHead == LINK_RAW_CABLE_QUEUE_SIZE) {
+      droppedResponses++;
+      return;
+    }
+    responses[responsesTail % LINK_RAW_CABLE_QUEUE_SIZE] = response;
+    responsesTail++;
+  }
+
+  void startQueuedTransfer() {
+    setData(outgoing[outgoingHead % LINK_RAW_CABLE_QUEUE_SIZE]);
+    isStoringResponse =
+        outgoingStoresResponse[outgoingHead % LINK_RAW_CABLE_QUEUE_SIZE];
+    outgoingHead++;
+    asyncState = WAITING;
+    if (isQueuePolling)
+      setInterruptsOff();
+    else
+      setInterruptsOn();
+    startTransfer();
+  }
+
+  void resetQueue() {
+    outgoingHead = outgoingTail = 0;
+    responsesHead = responsesTail = 0;
+    droppedResponses = 0;
+    isQueueActive = false;
+    isQueuePolling = false;
+    isStoringResponse = false;
+  }
+
   void setMultiPlayMode() {
     REG_RCNT = REG_RCNT & ~(1 << LINK_RAW_CABLE_BIT_GENERAL_PURPOSE_HIGH);
     REG_SIOCNT = (1 << LINK_RAW_CABLE_BIT_MULTIPLAYER);
@@ -49,6 +49,8 @@
    LINK_RAW_WIRELESS_BROADCAST_RESPONSE_LENGTH)
 #define LINK_RAW_WIRELESS_COMMAND_HELLO 0x10
 #define LINK_RAW_WIRELESS_COMMAND_SETUP 0x17
+#define LINK_RAW_WIRELESS_COMMAND_SIGNAL_LEVEL 0x11
+#define LINK_RAW_WIRELESS_COMMAND_SYSTEM_STATUS 0x13
 #define LINK_RAW_WIRELESS_COMMAND_BROADCAST 0x16
 #define LINK_RAW_WIRELESS_COMMAND_START_HOST 0x19
 #define LINK_RAW_WIRELESS_COMMAND_SLOT_STATUS 0x14
@@ -78,6 +80,13 @@ class LinkRawWireless {
   Logger logger = [](std::string str) {};
 #endif
 
+  // GBA Timer to use for SO/SI handshakes, or -1 to busy-wait
+  // (add `LINK_RAW_WIRELESS_ISR_ACK_TIMER` to its interrupt)
+  s8 ackTimerId = -1;
+  // Set to `false` while sending commands from an interrupt handler
+  // (the handshakes busy-wait then, since the timer can't wake the CPU up)
+  bool canSleep = true;
+
   enum State {
     NEEDS_RESET,
     AUTHENTICATED,
@@ -115,6 +124,16 @@ class LinkRawWireless {
     u8 clientNumber = 0;
   };
 
+  struct SignalLevelResponse {
+    std::array<u8, LINK_RAW_WIRELESS_MAX_PLAYERS> signalLevels = {};
+  };
+
+  struct SystemStatusResponse {
+    u16 deviceId = 0;
+    u8 currentPlayerId = 0;
+    State adapterState = AUTHENTICATED;
+  };
+
   struct SlotStatusResponse {
     u8 nextClientNumber = 0;
     std::array<ConnectedClient, LINK_RAW_WIRELESS_MAX_PLAYERS>
@@ -235,6 +254,67 @@ class LinkRawWireless {
     return true;
   }
 
+  bool getSignalLevel(SignalLevelResponse& response) {
+    auto result = sendCommand(LINK_RAW_WIRELESS_COMMAND_SIGNAL_LEVEL);
+
+    if (!result.success || result.responsesSize == 0) {
+      reset();
+      return false;
+    }
+
+    // (one byte per client, 0 means disconnected)
+    response.signalLevels[0] = 0;
+    for (u32 i = 1; i < LINK_RAW_WIRELESS_MAX_PLAYERS; i++)
+      response.signalLevels[i] = (result.responses[0] >> ((i - 1) * 8)) & 0xff;
+
+    return true;
+  }
+
+  bool getSystemStatus(SystemStatusResponse& response) {
+    auto result = sendCommand(LINK_RAW_WIRELESS_COMMAND_SYSTEM_STATUS);
+
+    if (!result.success || result.responsesSize == 0) {
+      reset();
+      return false;
+    }
+
+    u32 status = result.responses[0];
+    u8 slots = (status >> 16) & 0b1111;
+    u8 adapterState = status >> 24;
+
+    response.deviceId = lsB32(status);
+    response.currentPlayerId = 0;
+    for (u32 i = 0; i < LINK_RAW_WIRELESS_MAX_PLAYERS - 1; i++) {
+      if (slots & (1 << i))
+        response.currentPlayerId = 1 + i;
+    }
+
+    switch (adapterState) {
+      case 1:
+      case 2: {
+        response.adapterState = SERVING;
+        break;
+      }
+      case 3: {
+        response.adapterState = SEARCHING;
+        break;
+      }
+      case 4: {
+        response.adapterState = CONNECTING;
+        break;
+      }
+      case 5: {
+        response.adapterState = CONNECTED;
+        break;
+      }
+      default: {
+        response.adapterState = AUTHENTICATED;
+      }
+    }
+
+    return true;
+  }
+
   bool getSlotStatus(SlotStatusResponse& response) {
     auto result = sendCommand(LINK_RAW_WIRELESS_COMMAND_SLOT_STATUS);
 
@@ -687,6 +767,8 @@ class LinkRawWireless {
   u8 playerCount() { return sessionState.playerCount; }
   u8 currentPlayerId() { return sessionState.currentPlayerId; }
 
+  void _onACKTimer() { linkSPI->_onHandshakeTimer(); }
+
   ~LinkRawWireless() {
     delete linkSPI;
     delete linkGPIO;
@@ -703,7 +785,7 @@ class LinkRawWireless {
   };
 
   SessionState sessionState;
-  LinkSPI* linkSPI = new LinkSPI();
+  LinkSPI32* linkSPI = new LinkSPI32();
   LinkGPIO* linkGPIO = new LinkGPIO();
   State state = NEEDS_RESET;
   volatile bool isEnabled = false;
@@ -860,80 +942,27 @@ class LinkRawWireless {
   }
 
   bool acknowledge() {
-    u32 lines = 0;
-    u32 vCount = REG_VCOUNT;
-
-    linkSPI->_setSOLow();
-    while (!linkSPI->_isSIHigh()) {
-      if (cmdTimeout(lines, vCount)) {
-        LRWLOG("! ACK 1 failed. I put SO=LOW,");
-        LRWLOG("! but SI didn't become HIGH.");
-        return false;
-      }
-    }
-    linkSPI->_setSOHigh();
-    while (linkSPI->_isSIHigh()) {
-      if (cmdTimeout(lines, vCount)) {
-        LRWLOG("! ACK 2 failed. I put SO=HIGH,");
-        LRWLOG("! but SI didn't become LOW.");
-        return false;
-      }
-    }
-    linkSPI->_setSOLow();
-
-    return true;
+    return handshake(LinkSPI::HandshakeType::ACKNOWLEDGE);
   }
 
   bool reverseAcknowledgeStart() {
-    u32 lines = 0;
-    u32 vCount = REG_VCOUNT;
-
-    linkSPI->_setSOLow();
-    wait(1);
-    linkSPI->_setSOHigh();
-    while (linkSPI->_isSIHigh()) {
-      if (cmdTimeout(lines, vCount)) {
-        LRWLOG("! Rev0 failed. I put SO=HIGH,");
-        LRWLOG("! but SI didn't become LOW.");
-        return false;
-      }
-    }
-    linkSPI->_setSOLow();
-
-    return true;
+    return handshake(LinkSPI::HandshakeType::REVERSE_ACKNOWLEDGE_START);
   }
 
   bool reverseAcknowledge(bool isLastPart = false) {
-    u32 lines = 0;
-    u32 vCount = REG_VCOUNT;
-
-    linkSPI->_setSOLow();
-    while (linkSPI->_isSIHigh()) {
-      if (cmdTimeout(lines, vCount)) {
-        LRWLOG("! RevAck0 failed. I put SO=LOW,");
-        LRWLOG("! but SI didn't become LOW.");
-        return false;
-      }
-    }
+    // (normally, the last step occurs on the next linkSPI->transfer(...) call)
+    return handshake(isLastPart
+                         ? LinkSPI::HandshakeType::REVERSE_ACKNOWLEDGE_LAST
+                         : LinkSPI::HandshakeType::REVERSE_ACKNOWLEDGE);
+  }
 
-    linkSPI->_setSOHigh();
-    while (!linkSPI->_isSIHigh()) {
-      if (cmdTimeout(lines, vCount)) {
-        LRWLOG("! RevAck1 failed. I put SO=HIGH,");
-        LRWLOG("! but SI didn't become HIGH.");
-        return false;
-      }
-    }
-    // (normally, this occurs on the next linkSPI->transfer(...) call)
-    if (isLastPart) {
-      linkSPI->_setSOLow();
-      while (linkSPI->_isSIHigh()) {
-        if (cmdTimeout(lines, vCount)) {
-          LRWLOG("! RevAck2 failed. I put SO=LOW,");
-          LRWLOG("! but SI didn't become LOW.");
-          return false;
-        }
-      }
+  bool handshake(LinkSPI::HandshakeType type) {
+    if (!linkSPI->handshake(type, ackTimerId, LINK_RAW_WIRELESS_CMD_TIMEOUT,
+                            canSleep)) {
+      LRWLOG("! " + getHandshakeName(type) + " failed at step " +
+             std::to_string(linkSPI->_getHandshakeStep()) + ".");
+      LRWLOG("! SI didn't change in time.");
+      return false;
     }
 
     return true;
@@ -970,6 +999,17 @@ class LinkRawWireless {
   }
 
 #ifdef LINK_RAW_WIRELESS_ENABLE_LOGGING
+  std::string getHandshakeName(LinkSPI::HandshakeType type) {
+    switch (type) {
+      case LinkSPI::HandshakeType::ACKNOWLEDGE:
+        return "ACK";
+      case LinkSPI::HandshakeType::REVERSE_ACKNOWLEDGE_START:
+        return "Rev0";
+      default:
+        return "RevAck";
+    }
+  }
+
   template <typename I>
   std::string toHex(I w, size_t hex_len = sizeof(I) << 1) {
     static const char* digits = "0123456789ABCDEF";
@@ -990,6 +1030,10 @@ class LinkRawWireless {
 
 extern LinkRawWireless* linkRawWireless;
 
+inline void LINK_RAW_WIRELESS_ISR_ACK_TIMER() {
+  linkRawWireless->_onACKTimer();
+}
+
 #undef LRWLOG
 
 #endif  // LINK_RAW_WIRELESS_H
@@ -2,7 +2,7 @@
 #define LINK_SPI_H
 
 // --------------------------------------------------------------------------
-// An SPI handler for the Link Port (Normal Mode, 32bits).
+// An SPI handler for the Link Port (Normal Mode, 32bits or 8bits).
 // --------------------------------------------------------------------------
 // Usage:
 // - 1) Include this header in your main.cpp file and add:
@@ -14,6 +14,7 @@
 // - 3) Initialize the library with:
 //       linkSPI->activate(LinkSPI::Mode::MASTER_256KBPS);
 //       // (use LinkSPI::Mode::SLAVE on the other end)
+//       // (for 8-bit packets, use `LinkSPI8` instead of `LinkSPI`)
 // - 4) Exchange 32-bit data with the other end:
 //       u32 data = linkSPI->transfer(0x12345678);
 //       // (this blocks the console indefinitely)
@@ -29,6 +30,27 @@
 //         u32 data = linkSPI->getAsyncData();
 //         // ...
 //       }
+// - 7) Exchange a block of data asynchronously:
+//       linkSPI->transferBlockAsync(dataOut, dataIn, size);
+//       // ...
+//       if (linkSPI->getAsyncState() == LinkSPI::AsyncState::READY) {
+//         linkSPI->getAsyncData();
+//         // (`dataIn` is filled now)
+//       }
+// - 8) Receive a stream of data as slave:
+//       linkSPI->startStream();
+//       // ...
+//       while (linkSPI->canReadStream()) {
+//         u32 data = linkSPI->readStream();
+//         // ...
+//       }
+// - 9) (Optional) Add a timer for SO/SI handshakes:
+//       irq_add(II_TIMER2, LINK_SPI_ISR_HANDSHAKE_TIMER);
+//       // (only required for `startHandshakeAsync` with a timer,
+//       // or for `handshake` with a timer if you use libtonc's handler)
+//       // (`handshake` only sleeps if the timer IRQ is enabled and the
+//       // caller allows it, so pass `canSleep = false` inside interrupt
+//       // handlers, otherwise it never wakes up)
 // --------------------------------------------------------------------------
 // (*) libtonc's interrupt handler sometimes ignores interrupts due to a bug.
 //     That causes packet loss. You REALLY want to use libugba's instead.
@@ -37,34 +59,23 @@
 // considerations:
 // - when using Normal Mode between two GBAs, use a GBC Link Cable!
 // - only use the 2Mbps mode with custom hardware (very short wires)!
-// - don't send 0xFFFFFFFF, it's reserved for errors!
+// - don't send 0xFFFFFFFF (or 0xFF in 8-bit mode), it's reserved for errors!
 // --------------------------------------------------------------------------
 
+#include <tonc_bios.h>
 #include <tonc_core.h>
 
-// 8-bit mode (uncomment to enable)
-// #define LINK_SPI_8BIT_MODE
+#define LINK_SPI_NO_DATA 0xffffffff
+#define LINK_SPI_NO_DATA_8BIT 0xff
 
-#ifdef LINK_SPI_8BIT_MODE
-#define LINK_SPI_DATA_TYPE u8
-#endif
-#ifndef LINK_SPI_8BIT_MODE
-#define LINK_SPI_DATA_TYPE u32
-#endif
+// Max iterations waiting for the slave between block words (in `waitMode`)
+#define LINK_SPI_BLOCK_WAIT_ITERATIONS 10000
 
-#ifdef LINK_SPI_8BIT_MODE
-#define LINK_SPI_DATA_REG REG_SIODATA8
-#endif
-#ifndef LINK_SPI_8BIT_MODE
-#define LINK_SPI_DATA_REG REG_SIODATA32
-#endif
+// Stream buffer size (received words in slave streams, use a power of 2)
+#define LINK_SPI_STREAM_BUFFER_SIZE 64
 
-#ifdef LINK_SPI_8BIT_MODE
-#define LINK_SPI_NO_DATA 0xff
-#endif
-#ifndef LINK_SPI_8BIT_MODE
-#define LINK_SPI_NO_DATA 0xffffffff
-#endif
+#define LINK_SPI_HANDSHAKE_TIMER_FREQUENCY TM_FREQ_1024
+#define LINK_SPI_HANDSHAKE_MAX_STEPS 3
 
 #define LINK_SPI_BIT_CLOCK 0
 #define LINK_SPI_BIT_CLOCK_SPEED 1
@@ -80,12 +91,38 @@ static volatile char LINK_SPI_VERSION[] = "LinkSPI/v6.3.0";
 
 const u32 LINK_SPI_MASK_CLEAR_SO_BIT = ~(1 << LINK_SPI_BIT_SO);
 const u32 LINK_SPI_MASK_SET_START_BIT = (1 << LINK_SPI_BIT_START);
+const u16 LINK_SPI_TIMER_IRQ_IDS[] = {IRQ_TIMER0, IRQ_TIMER1, IRQ_TIMER2,
+                                      IRQ_TIMER3};
 
-class LinkSPI {
+class LinkSPITypes {
  public:
   enum Mode { SLAVE, MASTER_256KBPS, MASTER_2MBPS };
+  enum DataSize { SIZE_32BIT, SIZE_8BIT };
   enum AsyncState { IDLE, WAITING, READY };
 
+  enum HandshakeType {
+    ACKNOWLEDGE,
+    REVERSE_ACKNOWLEDGE,
+    REVERSE_ACKNOWLEDGE_LAST,
+    REVERSE_ACKNOWLEDGE_START
+  };
+  enum HandshakeState {
+    HANDSHAKE_IDLE,
+    HANDSHAKE_WAITING,
+    HANDSHAKE_DONE,
+    HANDSHAKE_FAILED
+  };
+};
+
+// (the data size is a template parameter, so the register accesses don't
+// have to check it at runtime)
+template <LinkSPITypes::DataSize Size>
+class LinkSPIBase : public LinkSPITypes {
+ public:
+  static constexpr DataSize dataSize = Size;
+
+  typedef u32 (*StreamResponder)(u32 receivedData);
+
   bool isActive() { return isEnabled; }
 
   void activate(Mode mode) {
@@ -93,8 +130,11 @@ class LinkSPI {
     this->waitMode = false;
     this->asyncState = IDLE;
     this->asyncData = 0;
+    resetBlock();
+    resetStream();
+    resetHandshake();
 
-    setNormalMode32Bit();
+    setNormalMode();
     disableTransfer();
 
     if (mode == SLAVE)
@@ -119,19 +159,22 @@ class LinkSPI {
     waitMode = false;
     asyncState = IDLE;
     asyncData = 0;
+    resetBlock();
+    resetStream();
+    resetHandshake();
   }
 
-  LINK_SPI_DATA_TYPE transfer(LINK_SPI_DATA_TYPE data) {
+  u32 transfer(u32 data) {
     return transfer(data, []() { return false; });
   }
 
   template <typename F>
-  LINK_SPI_DATA_TYPE transfer(LINK_SPI_DATA_TYPE data,
-                              F cancel,
-                              bool _async = false,
-                              bool _customAck = false) {
+  u32 transfer(u32 data,
+               F cancel,
+               bool _async = false,
+               bool _customAck = false) {
     if (asyncState != IDLE)
-      return LINK_SPI_NO_DATA;
+      return getNoData();
 
     setData(data);
 
@@ -147,20 +190,20 @@ class LinkSPI {
         disableTransfer();
         setInterruptsOff();
         asyncState = IDLE;
-        return LINK_SPI_NO_DATA;
+        return getNoData();
       }
 
     enableTransfer();
     startTransfer();
 
     if (_async)
-      return LINK_SPI_NO_DATA;
+      return getNoData();
 
     while (!isReady())
       if (cancel()) {
         stopTransfer();
         disableTransfer();
-        return LINK_SPI_NO_DATA;
+        return getNoData();
       }
 
     if (!_customAck)
@@ -169,26 +212,133 @@ class LinkSPI {
     return getData();
   }
 
-  void transferAsync(LINK_SPI_DATA_TYPE data) {
+  void transferAsync(u32 data) {
     transfer(
         data, []() { return false; }, true);
   }
 
   template <typename F>
-  void transferAsync(LINK_SPI_DATA_TYPE data, F cancel) {
+  void transferAsync(u32 data, F cancel) {
     transfer(data, cancel, true);
   }
 
-  LINK_SPI_DATA_TYPE getAsyncData() {
+  bool transferBlockAsync(const u32* dataOut, u32* dataIn, u32 size) {
+    return transferBlockAsync(dataOut, dataIn, size, []() { return false; });
+  }
+
+  template <typename F>
+  bool transferBlockAsync(const u32* dataOut,
+                          u32* dataIn,
+                          u32 size,
+                          F cancel) {
+    if (!isEnabled || asyncState != IDLE || size == 0)
+      return false;
+
+    blockOut = dataOut;
+    blockIn = dataIn;
+    blockSize = size;
+    blockProgress = 0;
+
+    // (the rest of the words are sent by `_onSerial()`)
+    transfer(dataOut[0], cancel, true);
+    if (asyncState == IDLE) {
+      resetBlock();
+      return false;
+    }
+
+    return true;
+  }
+
+  u32 getAsyncData() {
     if (asyncState != READY)
-      return LINK_SPI_NO_DATA;
+      return getNoData();
 
-    LINK_SPI_DATA_TYPE data = asyncData;
+    u32 data = asyncData;
+    blockSize = 0;
     asyncState = IDLE;
     return data;
   }
 
+  u32 getAsyncBlockProgress() { return blockProgress; }
+
+  bool startStream(u32 firstResponse = LINK_SPI_NO_DATA,
+                   StreamResponder responder = nullptr) {
+    if (!isEnabled || isMaster() || asyncState != IDLE)
+      return false;
+
+    resetStream();
+    streamResponder = responder;
+    isStreaming = true;
+    asyncState = WAITING;
+
+    setData(firstResponse);
+    setInterruptsOn();
+    enableTransfer();
+    startTransfer();
+    return true;
+  }
+
+  void stopStream() {
+    if (!isStreaming)
+      return;
+
+    stopTransfer();
+    disableTransfer();
+    setInterruptsOff();
+    isStreaming = false;
+    asyncState = IDLE;
+  }
+
+  bool isStreamActive() { return isStreaming; }
+  bool canReadStream() { return streamTail != streamHead; }
+
+  u32 readStream() {
+    if (!canReadStream())
+      return getNoData();
+
+    u32 data = streamBuffer[streamHead % LINK_SPI_STREAM_BUFFER_SIZE];
+    streamHead++;
+    return data;
+  }
+
+  u32 getStreamDroppedWords() { return streamDroppedWords; }
+
+  bool handshake(HandshakeType type,
+                 s8 timerId,
+                 u32 timeoutLines,
+                 bool canSleep) {
+    startHandshake(type, timerId, timeoutLines, true);
+
+    // (with a timer, the CPU sleeps between checks, unless the timer
+    // interrupt can't wake it up: then, it falls back to busy-waiting)
+    bool sleep = canSleep && timerId > -1 && REG_IME &&
+                 (REG_IE & LINK_SPI_TIMER_IRQ_IDS[timerId]);
+    while (currentHandshake.state == HANDSHAKE_WAITING) {
+      if (sleep)
+        IntrWait(1, LINK_SPI_TIMER_IRQ_IDS[timerId]);
+      processHandshake();
+    }
+
+    return currentHandshake.state == HANDSHAKE_DONE;
+  }
+
+  HandshakeState startHandshakeAsync(HandshakeType type,
+                                     s8 timerId,
+                                     u32 timeoutLines) {
+    startHandshake(type, timerId, timeoutLines, false);
+
+    // (without a timer, there's no other way than busy-waiting)
+    if (timerId == -1)
+      while (currentHandshake.state == HANDSHAKE_WAITING)
+        processHandshake();
+
+    return currentHandshake.state;
+  }
+
+  HandshakeState getHandshakeState() { return currentHandshake.state; }
+
   Mode getMode() { return mode; }
+  static constexpr DataSize getDataSize() { return dataSize; }
   void setWaitModeActive(bool isActive) { waitMode = isActive; }
   bool isWaitModeActive() { return waitMode; }
   AsyncState getAsyncState() { return asyncState; }
@@ -197,33 +347,234 @@ class LinkSPI {
     if (!isEnabled || asyncState != WAITING)
       return;
 
+    if (isStreaming) {
+      receiveStreamWord();
+      return;
+    }
+
     if (!_customAck)
       disableTransfer();
 
+    u32 data = getData();
+    if (blockSize > 0) {
+      if (blockIn != nullptr)
+        blockIn[blockProgress] = data;
+      blockProgress++;
+
+      if (blockProgress < blockSize && transferNextBlockWord())
+        return;
+    }
+
     setInterruptsOff();
     asyncState = READY;
-    asyncData = getData();
+    asyncData = data;
   }
 
+  bool _onHandshakeTimer() {
+    if (!isEnabled || currentHandshake.state != HANDSHAKE_WAITING ||
+        currentHandshake.isBlocking)
+      return false;
+
+    processHandshake();
+    return currentHandshake.state != HANDSHAKE_WAITING;
+  }
+
+  u32 _getHandshakeStep() { return currentHandshake.step; }
+
   void _setSOHigh() { setBitHigh(LINK_SPI_BIT_SO); }
   void _setSOLow() { setBitLow(LINK_SPI_BIT_SO); }
   bool _isSIHigh() { return isBitHigh(LINK_SPI_BIT_SI); }
 
  private:
+  enum HandshakeWait { WAIT_NONE, WAIT_SI_HIGH, WAIT_SI_LOW, WAIT_LINE };
+
+  struct HandshakeStep {
+    bool isSOHigh;
+    HandshakeWait wait;
+  };
+
+  struct Handshake {
+    HandshakeType type = ACKNOWLEDGE;
+    volatile HandshakeState state = HANDSHAKE_IDLE;
+    u32 step = 0;
+    s8 timerId = -1;
+    bool isBlocking = false;
+    u32 timeoutLines = 0;
+    u32 lines = 0;
+    u32 vCount = 0;
+    u32 stepVCount = 0;
+  };
+
+  Handshake currentHandshake;
   Mode mode = Mode::SLAVE;
   bool waitMode = false;
   AsyncState asyncState = IDLE;
-  LINK_SPI_DATA_TYPE asyncData = 0;
+  u32 asyncData = 0;
+  const u32* blockOut = nullptr;
+  u32* blockIn = nullptr;
+  u32 blockSize = 0;
+  volatile u32 blockProgress = 0;
+  u32 streamBuffer[LINK_SPI_STREAM_BUFFER_SIZE];
+  volatile u32 streamHead = 0;  // (next word to read)
+  volatile u32 streamTail = 0;  // (next word to write)
+  volatile u32 streamDroppedWords = 0;
+  StreamResponder streamResponder = nullptr;
+  volatile bool isStreaming = false;
   volatile bool isEnabled = false;
 
-  void setNormalMode32Bit() {
+  void receiveStreamWord() {
+    disableTransfer();
+    u32 data = getData();
+
+    // (the next reply is loaded and the slave is re-armed right away, so the
+    // master can clock the next word without waiting for the game loop)
+    setData(streamResponder != nullptr ? streamResponder(data) : getNoData());
+    enableTransfer();
+    startTransfer();
+
+    if (streamTail - streamHead == LINK_SPI_STREAM_BUFFER_SIZE) {
+      streamDroppedWords++;
+      return;
+    }
+    streamBuffer[streamTail % LINK_SPI_STREAM_BUFFER_SIZE] = data;
+    streamTail++;
+  }
+
+  void startHandshake(HandshakeType type,
+                      s8 timerId,
+                      u32 timeoutLines,
+                      bool isBlocking) {
+    resetHandshake();
+    currentHandshake.type = type;
+    currentHandshake.timerId = timerId;
+    currentHandshake.isBlocking = isBlocking;
+    currentHandshake.timeoutLines = timeoutLines;
+    currentHandshake.vCount = REG_VCOUNT;
+    currentHandshake.state = HANDSHAKE_WAITING;
+
+    // (most handshakes finish right away, the timer is only for slow ones)
+    enterHandshakeStep();
+    processHandshake();
+    if (currentHandshake.state == HANDSHAKE_WAITING && timerId > -1) {
+      REG_TM[timerId].start = -1;
+      REG_TM[timerId].cnt =
+          TM_ENABLE | TM_IRQ | LINK_SPI_HANDSHAKE_TIMER_FREQUENCY;
+    }
+  }
+
+  void processHandshake() {
+    while (currentHandshake.state == HANDSHAKE_WAITING) {
+      HandshakeStep step = getHandshakeStep(currentHandshake.step);
+      if (!isHandshakeWaitOver(step.wait)) {
+        if (isHandshakeTimedOut())
+          finishHandshake(HANDSHAKE_FAILED);
+        return;
+      }
+
+      currentHandshake.step++;
+      if (currentHandshake.step == getHandshakeLength())
+        finishHandshake(HANDSHAKE_DONE);
+      else
+        enterHandshakeStep();
+    }
+  }
+
+  void enterHandshakeStep() {
+    if (getHandshakeStep(currentHandshake.step).isSOHigh)
+      _setSOHigh();
+    else
+      _setSOLow();
+    currentHandshake.stepVCount = REG_VCOUNT;
+  }
+
+  bool isHandshakeWaitOver(HandshakeWait wait) {
+    switch (wait) {
+      case WAIT_SI_HIGH:
+        return _isSIHigh();
+      case WAIT_SI_LOW:
+        return !_isSIHigh();
+      case WAIT_LINE:
+        return REG_VCOUNT != currentHandshake.stepVCount;
+      default:
+        return true;
+    }
+  }
+
+  bool isHandshakeTimedOut() {
+    u32 vCount = REG_VCOUNT;
+    if (vCount > currentHandshake.vCount)
+      currentHandshake.lines += vCount - currentHandshake.vCount;
+    currentHandshake.vCount = vCount;
+
+    return currentHandshake.lines > currentHandshake.timeoutLines;
+  }
+
+  void finishHandshake(HandshakeState state) {
+    if (currentHandshake.timerId > -1)
+      REG_TM[currentHandshake.timerId].cnt =
+          REG_TM[currentHandshake.timerId].cnt & (~TM_ENABLE);
+    currentHandshake.state = state;
+  }
+
+  void resetHandshake() {
+    if (currentHandshake.state == HANDSHAKE_WAITING)
+      finishHandshake(HANDSHAKE_IDLE);
+    currentHandshake = Handshake{};
+  }
+
+  u32 getHandshakeLength() {
+    return currentHandshake.type == REVERSE_ACKNOWLEDGE ? 2 : 3;
+  }
+
+  HandshakeStep getHandshakeStep(u32 index) {
+    // (each step sets SO and then waits for something)
+    static const HandshakeStep STEPS[][LINK_SPI_HANDSHAKE_MAX_STEPS] = {
+        // ACKNOWLEDGE
+        {{false, WAIT_SI_HIGH}, {true, WAIT_SI_LOW}, {false, WAIT_NONE}},
+        // REVERSE_ACKNOWLEDGE
+        {{false, WAIT_SI_LOW}, {true, WAIT_SI_HIGH}, {false, WAIT_NONE}},
+        // REVERSE_ACKNOWLEDGE_LAST
+        {{false, WAIT_SI_LOW}, {true, WAIT_SI_HIGH}, {false, WAIT_SI_LOW}},
+        // REVERSE_ACKNOWLEDGE_START
+        {{false, WAIT_LINE}, {true, WAIT_SI_LOW}, {false, WAIT_NONE}}};
+
+    return STEPS[currentHandshake.type][index];
+  }
+
+  void resetStream() {
+    streamHead = 0;
+    streamTail = 0;
+    streamDroppedWords = 0;
+    streamResponder = nullptr;
+    isStreaming = false;
+  }
+
+  bool transferNextBlockWord() {
+    setData(blockOut[blockProgress]);
+
+    if (isMaster() && waitMode) {
+      // (if the slave doesn't get ready in time, the block is aborted)
+      u32 iterations = 0;
+      while (!isSlaveReady())
+        if (++iterations > LINK_SPI_BLOCK_WAIT_ITERATIONS)
+          return false;
+    }
+
+    enableTransfer();
+    startTransfer();
+    return true;
+  }
+
+  void resetBlock() {
+    blockOut = nullptr;
+    blockIn = nullptr;
+    blockSize = 0;
+    blockProgress = 0;
+  }
+
+  void setNormalMode() {
     REG_RCNT = REG_RCNT & ~(1 << LINK_SPI_BIT_GENERAL_PURPOSE_HIGH);
-#ifdef LINK_SPI_8BIT_MODE
-    REG_SIOCNT = 0;
-#endif
-#ifndef LINK_SPI_8BIT_MODE
-    REG_SIOCNT = 1 << LINK_SPI_BIT_LENGTH;
-#endif
+    REG_SIOCNT = Size == SIZE_32BIT ? 1 << LINK_SPI_BIT_LENGTH : 0;
   }
 
   void setGeneralPurposeMode() {
@@ -231,8 +582,23 @@ class LinkSPI {
                (1 << LINK_SPI_BIT_GENERAL_PURPOSE_HIGH);
   }
 
-  void setData(LINK_SPI_DATA_TYPE data) { LINK_SPI_DATA_REG = data; }
-  LINK_SPI_DATA_TYPE getData() { return LINK_SPI_DATA_REG; }
+  void setData(u32 data) {
+    if constexpr (Size == SIZE_32BIT)
+      REG_SIODATA32 = data;
+    else
+      REG_SIODATA8 = data & 0xff;
+  }
+
+  u32 getData() {
+    if constexpr (Size == SIZE_32BIT)
+      return REG_SIODATA32;
+    else
+      return REG_SIODATA8 & 0xff;
+  }
+
+  static constexpr u32 getNoData() {
+    return Size == SIZE_32BIT ? LINK_SPI_NO_DATA : LINK_SPI_NO_DATA_8BIT;
+  }
 
   void enableTransfer() { _setSOLow(); }
   void disableTransfer() { _setSOHigh(); }
@@ -254,10 +620,24 @@ class LinkSPI {
   void setBitLow(u8 bit) { REG_SIOCNT &= ~(1 << bit); }
 };
 
+using LinkSPI32 = LinkSPIBase<LinkSPITypes::SIZE_32BIT>;
+using LinkSPI8 = LinkSPIBase<LinkSPITypes::SIZE_8BIT>;
+
+#ifdef LINK_SPI_8BIT_MODE
+// (deprecated: use `LinkSPI8` instead)
+using LinkSPI = LinkSPI8;
+#else
+using LinkSPI = LinkSPI32;
+#endif
+
 extern LinkSPI* linkSPI;
 
 inline void LINK_SPI_ISR_SERIAL() {
   linkSPI->_onSerial();
 }
 
+inline void LINK_SPI_ISR_HANDSHAKE_TIMER() {
+  linkSPI->_onHandshakeTimer();
+}
+
 #endif  // LINK_SPI_H
@@ -42,6 +42,7 @@
 // `send(...)` restrictions:
 // - 0xFFFF and 0x0 are reserved values, so don't use them!
 //   (they mean 'disconnected' and 'no data' respectively)
+// - When `failover` is enabled, 0xFFFD is also reserved.
 // --------------------------------------------------------------------------
 
 #include <tonc_bios.h>
@@ -54,7 +55,7 @@
 // Max players. Default = 5 (keep in mind that LinkCable's limit is 4)
 #define LINK_UNIVERSAL_MAX_PLAYERS LINK_WIRELESS_MAX_PLAYERS
 
-// Game ID Filter. Default = 0 (no filter)
+// Default Game ID Filter. Default = 0 (no filter)
 #define LINK_UNIVERSAL_GAME_ID_FILTER 0
 
 #define LINK_UNIVERSAL_DISCONNECTED LINK_CABLE_DISCONNECTED
@@ -63,9 +64,35 @@
 #define LINK_UNIVERSAL_INIT_WAIT_FRAMES 10
 #define LINK_UNIVERSAL_SWITCH_WAIT_FRAMES 25
 #define LINK_UNIVERSAL_SWITCH_WAIT_FRAMES_RANDOM 10
+#define LINK_UNIVERSAL_MAX_CABLE_HINT_PERIODS 3
 #define LINK_UNIVERSAL_BROADCAST_SEARCH_WAIT_FRAMES 10
+#define LINK_UNIVERSAL_CACHED_ROOM_MAX_AGE_FRAMES 60
 #define LINK_UNIVERSAL_SERVE_WAIT_FRAMES 60
 #define LINK_UNIVERSAL_SERVE_WAIT_FRAMES_RANDOM 30
+#define LINK_UNIVERSAL_SESSION_CONTROL 0xfffd
+#define LINK_UNIVERSAL_SESSION_ACK 0x4000
+#define LINK_UNIVERSAL_SESSION_RESUME 0x8000
+#define LINK_UNIVERSAL_SESSION_SEQ 0xc000
+#define LINK_UNIVERSAL_SESSION_TYPE_MASK 0xc000
+#define LINK_UNIVERSAL_SESSION_COUNT_MASK 0x1fff
+#define LINK_UNIVERSAL_SESSION_ACK_INTERVAL_FRAMES 4
+#define LINK_UNIVERSAL_SESSION_SEQ_INTERVAL_FRAMES 4
+#define LINK_UNIVERSAL_SESSION_RESYNC_FRAMES 30
+#define LINK_UNIVERSAL_CYCLES_PER_FRAME 280896
+#define LINK_UNIVERSAL_CABLE_CYCLES_PER_TICK 1024
+
+// Replay buffer size (unacknowledged messages, failover only)
+#define LINK_UNIVERSAL_REPLAY_BUFFER_SIZE 32
+
+// Max unacknowledged messages in the transport (failover only)
+// (must be smaller than LinkCable's and LinkWireless' incoming queues)
+#define LINK_UNIVERSAL_SESSION_WINDOW 10
+
+// Max messages handed to the wireless transport per frame (failover only)
+#define LINK_UNIVERSAL_MAX_SENDS_PER_FRAME 8
+
+// Frames without a transport before giving up the session (failover only)
+#define LINK_UNIVERSAL_FAILOVER_TIMEOUT_FRAMES 600
 
 static volatile char LINK_UNIVERSAL_VERSION[] = "LinkUniversal/v6.3.0";
 
@@ -85,6 +112,40 @@ class LinkUniversal {
     WIRELESS_CLIENT
   };
 
+  enum EventType {
+    MODE_SWITCHED,
+    SEARCHING,
+    JOINING,
+    SERVING,
+    CONNECTION_ESTABLISHED,
+    PLAYER_JOINED,
+    PLAYER_LEFT,
+    CONNECTION_LOST,
+    TIMED_OUT
+  };
+
+  struct Event {
+    EventType type;
+    u32 frame;
+    Mode mode;
+    u8 playerCount;
+  };
+
+  typedef void (*EventListener)(Event event);
+
+  struct Stats {
+    u32 attempts = 0;
+    u32 modeSwitches = 0;
+    u32 searches = 0;
+    u32 serves = 0;
+    u32 timeouts = 0;
+    u32 connections = 0;
+    u32 disconnections = 0;
+    u32 lastConnectionFrames = 0;
+    u32 totalConnectionFrames = 0;
+    u32 resyncs = 0;
+  };
+
   struct CableOptions {
     LinkCable::BaudRate baudRate;
     u32 timeout;
@@ -93,6 +154,13 @@ class LinkUniversal {
     u8 sendTimerId;
   };
 
+  struct RoomFilter {
+    u16 gameId = LINK_UNIVERSAL_GAME_ID_FILTER;  // (0 = any)
+    bool matchGameName = true;
+    u8 minPlayers = 1;
+    u8 maxPlayers = LINK_UNIVERSAL_MAX_PLAYERS;
+  };
+
   struct WirelessOptions {
     bool retransmission;
     u32 maxPlayers;
@@ -115,7 +183,8 @@ class LinkUniversal {
           true, LINK_UNIVERSAL_MAX_PLAYERS, LINK_WIRELESS_DEFAULT_TIMEOUT,
           LINK_WIRELESS_DEFAULT_REMOTE_TIMEOUT, LINK_WIRELESS_DEFAULT_INTERVAL,
           LINK_WIRELESS_DEFAULT_SEND_TIMER_ID,
-          LINK_WIRELESS_DEFAULT_ASYNC_ACK_TIMER_ID}) {
+          LINK_WIRELESS_DEFAULT_ASYNC_ACK_TIMER_ID},
+      bool failover = false) {
     this->linkCable = new LinkCable(
         cableOptions.baudRate, cableOptions.timeout, cableOptions.remoteTimeout,
         cableOptions.interval, cableOptions.sendTimerId);
@@ -128,12 +197,15 @@ class LinkUniversal {
 
     this->config.protocol = protocol;
     this->config.gameName = gameName;
+    // (the session layer only works with 2 players)
+    this->config.failover = failover && wirelessOptions.maxPlayers == 2;
   }
 
   bool isActive() { return isEnabled; }
 
   void activate() {
     reset();
+    connectStartFrame = frameCount;
     isEnabled = true;
   }
 
@@ -141,20 +213,39 @@ class LinkUniversal {
     isEnabled = false;
     linkCable->deactivate();
     linkWireless->deactivate();
+    session.isActive = false;
     resetState();
   }
 
   void setProtocol(Protocol protocol) { this->config.protocol = protocol; }
   Protocol getProtocol() { return this->config.protocol; }
 
-  bool isConnected() { return state == CONNECTED; }
+  void setRoomFilter(RoomFilter roomFilter) {
+    this->config.roomFilter = roomFilter;
+  }
+  RoomFilter getRoomFilter() { return this->config.roomFilter; }
+
+  bool isConnected() { return state == CONNECTED || isFailingOver(); }
+  bool isFailingOver() { return session.isActive && session.isFailingOver; }
+  u32 getConnectionFrames() { return stats.lastConnectionFrames; }
+
+  void setEventListener(EventListener eventListener) {
+    this->eventListener = eventListener;
+  }
+  Stats getStats() { return stats; }
+  void resetStats() { stats = Stats{}; }
 
   u8 playerCount() {
-    return mode == LINK_CABLE ? linkCable->playerCount()
-                              : linkWireless->playerCount();
+    if (isFailingOver())
+      return 2;
+
+    return getTransportPlayerCount();
   }
 
   u8 currentPlayerId() {
+    if (session.isActive)
+      return session.playerId;
+
     return mode == LINK_CABLE ? linkCable->currentPlayerId()
                               : linkWireless->currentPlayerId();
   }
@@ -171,6 +262,11 @@ class LinkUniversal {
     if (mode == LINK_CABLE)
       linkCable->sync();
 
+    if (isFailingOver() && frameCount - session.failoverStartFrame >
+                               LINK_UNIVERSAL_FAILOVER_TIMEOUT_FRAMES)
+      endSession();
+    session.sendsThisFrame = 0;
+
     switch (state) {
       case INITIALIZING: {
         waitCount++;
@@ -182,25 +278,37 @@ class LinkUniversal {
         if (mode == LINK_CABLE) {
           // Cable, waiting...
           if (isConnectedCable()) {
-            state = CONNECTED;
+            setConnected();
             goto connected;
           }
+          if (config.protocol == AUTODETECT && linkCable->isCablePlugged() &&
+              cableHintCount <
+                  LINK_UNIVERSAL_MAX_CABLE_HINT_PERIODS * switchWait) {
+            // (there's a cable, so there can't be an adapter)
+            cableHintCount++;
+            waitCount = 0;
+          }
         } else {
           // Wireless, waiting...
           if (isConnectedWireless()) {
-            state = CONNECTED;
+            setConnected();
             goto connected;
           } else {
             if (!autoDiscoverWirelessConnections())
               waitCount = switchWait;
-            if (isConnectedWireless())
+            if (isConnectedWireless()) {
+              setConnected();
               goto connected;
+            }
           }
         }
 
         waitCount++;
-        if (waitCount > switchWait)
+        if (waitCount > switchWait) {
+          stats.timeouts++;
+          emit(TIMED_OUT);
           toggleMode();
+        }
 
         break;
       }
@@ -209,19 +317,27 @@ class LinkUniversal {
         if (mode == LINK_CABLE) {
           // Cable, connected...
           if (!isConnectedCable()) {
-            toggleMode();
+            disconnect();
             break;
           }
-
-          receiveCableMessages();
         } else {
           // Wireless, connected...
-          if (!isConnectedWireless()) {
-            toggleMode();
+          if (!isConnectedWireless() && !linkWireless->isResuming()) {
+            disconnect();
             break;
           }
+        }
+
+        u8 newPlayerCount = getTransportPlayerCount();
+        if (newPlayerCount != lastPlayerCount) {
+          bool didJoin = newPlayerCount > lastPlayerCount;
+          lastPlayerCount = newPlayerCount;
+          emit(didJoin ? PLAYER_JOINED : PLAYER_LEFT);
+        }
 
-          receiveWirelessMessages();
+        if (config.failover) {
+          receiveSessionControls();
+          flushSession(true);
         }
 
         break;
@@ -241,29 +357,70 @@ class LinkUniversal {
                                     : linkWireless->config.sendTimerId;
 
     while (isConnected() && !canRead(playerId) && !cancel()) {
-      IntrWait(1, IRQ_SERIAL | LINK_CABLE_TIMER_IRQ_IDS[timerId]);
+      // (while failing over, the transports might be inactive)
+      IntrWait(1, IRQ_SERIAL | LINK_CABLE_TIMER_IRQ_IDS[timerId] |
+                      (isFailingOver() ? IRQ_VBLANK : 0));
       sync();
     }
 
     return isConnected() && canRead(playerId);
   }
 
-  bool canRead(u8 playerId) { return !incomingMessages[playerId].isEmpty(); }
+  bool canRead(u8 playerId) {
+    if (config.failover) {
+      if (state != CONNECTED || playerId == session.playerId)
+        return false;
+
+      receiveSessionControls();
+      return canReadTransport(getRemotePlayerId());
+    }
+
+    return canReadTransport(playerId);
+  }
+
+  u16 read(u8 playerId) {
+    if (config.failover) {
+      if (!canRead(playerId))
+        return LINK_UNIVERSAL_NO_DATA;
+
+      // (only the messages read by the game are acknowledged)
+      session.receivedSeq++;
+      return readTransport(getRemotePlayerId());
+    }
+
+    return readTransport(playerId);
+  }
+
+  u16 peek(u8 playerId) {
+    if (config.failover) {
+      if (!canRead(playerId))
+        return LINK_UNIVERSAL_NO_DATA;
 
-  u16 read(u8 playerId) { return incomingMessages[playerId].pop(); }
+      return peekTransport(getRemotePlayerId());
+    }
 
-  u16 peek(u8 playerId) { return incomingMessages[playerId].peek(); }
+    return peekTransport(playerId);
+  }
 
   bool send(u16 data) {
     if (data == LINK_CABLE_DISCONNECTED || data == LINK_CABLE_NO_DATA)
       return false;
 
-    if (mode == LINK_CABLE) {
-      linkCable->send(data);
+    if (config.failover) {
+      if (data == LINK_UNIVERSAL_SESSION_CONTROL ||
+          session.nextSeq - session.ackedSeq ==
+              LINK_UNIVERSAL_REPLAY_BUFFER_SIZE)
+        return false;
+
+      session.buffer[session.nextSeq % LINK_UNIVERSAL_REPLAY_BUFFER_SIZE] =
+          data;
+      session.nextSeq++;
+      if (state == CONNECTED)
+        flushSession();
       return true;
-    } else {
-      return linkWireless->send(data);
     }
+
+    return sendToTransport(data);
   }
 
   State getState() { return state; }
@@ -279,6 +436,8 @@ class LinkUniversal {
   u32 _getSubWaitCount() { return subWaitCount; }
 
   void _onVBlank() {
+    frameCount++;
+
     if (mode == LINK_CABLE)
       linkCable->_onVBlank();
     else
@@ -311,51 +470,349 @@ class LinkUniversal {
   struct Config {
     Protocol protocol;
     const char* gameName;
+    bool failover;
+    RoomFilter roomFilter;
+  };
+
+  struct SessionState {
+    bool isActive = false;
+    bool isFailingOver = false;
+    u32 failoverStartFrame = 0;
+    u8 playerId = 0;
+
+    u16 buffer[LINK_UNIVERSAL_REPLAY_BUFFER_SIZE];
+    u32 nextSeq = 0;         // (messages queued by the game)
+    u32 ackedSeq = 0;        // (messages received by the remote player)
+    u32 transmittedSeq = 0;  // (messages handed to the current transport)
+    u32 receivedSeq = 0;     // (messages received from the remote player)
+    u32 lastAckSeq = 0;
+    u32 lastAckFrame = 0;
+    u32 sendsThisFrame = 0;
+
+    bool isWaitingResume = false;
+    bool isControlNext = false;
+    bool isMarkerPending = false;
+    u16 pendingControl = 0;
+
+    bool isSeqPending = false;
+    u32 lastSeqFrame = 0;
+    bool isDiscarding = false;  // (after a gap, until the replay arrives)
+    u32 lastResyncFrame = 0;
   };
 
-  LinkCable::U16Queue incomingMessages[LINK_UNIVERSAL_MAX_PLAYERS];
   Config config;
+  SessionState session;
+  Stats stats;
+  EventListener eventListener = nullptr;
   State state = INITIALIZING;
   Mode mode = LINK_CABLE;
   u32 waitCount = 0;
   u32 switchWait = 0;
   u32 subWaitCount = 0;
   u32 serveWait = 0;
+  u32 cableHintCount = 0;
+  bool isAdapterDetected = false;
+  bool didTryCachedRoom = false;
+  vu32 frameCount = 0;
+  u32 connectStartFrame = 0;
+  u8 lastPlayerCount = 0;
   volatile bool isEnabled = false;
 
-  void receiveCableMessages() {
-    for (u32 i = 0; i < LINK_CABLE_MAX_PLAYERS; i++) {
-      while (linkCable->canRead(i))
-        incomingMessages[i].push(linkCable->read(i));
-    }
+  u8 getTransportPlayerCount() {
+    return mode == LINK_CABLE ? linkCable->playerCount()
+                              : linkWireless->playerCount();
+  }
+
+  void emit(EventType type) {
+    // (events are only emitted from `sync()` and `activate()`, never from
+    // the interrupt handlers)
+    if (eventListener != nullptr)
+      eventListener(Event{type, frameCount, mode, getTransportPlayerCount()});
+  }
+
+  bool canReadTransport(u8 playerId) {
+    if (mode == LINK_CABLE)
+      return playerId < LINK_CABLE_MAX_PLAYERS && linkCable->canRead(playerId);
+    else
+      return linkWireless->canRead(playerId);
   }
 
-  void receiveWirelessMessages() {
-    LinkWireless::Message messages[LINK_WIRELESS_QUEUE_SIZE];
-    linkWireless->receive(messages);
+  u16 readTransport(u8 playerId) {
+    if (mode == LINK_CABLE)
+      return playerId < LINK_CABLE_MAX_PLAYERS ? linkCable->read(playerId)
+                                               : LINK_UNIVERSAL_NO_DATA;
+    else
+      return linkWireless->read(playerId);
+  }
 
-    for (u32 i = 0; i < LINK_WIRELESS_QUEUE_SIZE; i++) {
-      auto message = messages[i];
-      if (message.packetId == LINK_WIRELESS_END)
+  u16 peekTransport(u8 playerId) {
+    if (mode == LINK_CABLE)
+      return playerId < LINK_CABLE_MAX_PLAYERS ? linkCable->peek(playerId)
+                                               : LINK_UNIVERSAL_NO_DATA;
+    else
+      return linkWireless->peek(playerId);
+  }
+
+  u8 getRemotePlayerId() {
+    // (the player ids of the new transport might be different)
+    u8 transportPlayerId = mode == LINK_CABLE
+                               ? linkCable->currentPlayerId()
+                               : linkWireless->currentPlayerId();
+    return !transportPlayerId;
+  }
+
+  void receiveSessionControls() {
+    u8 remotePlayerId = getRemotePlayerId();
+
+    // (control words are consumed as soon as they reach the front)
+    while (canReadTransport(remotePlayerId)) {
+      u16 data = peekTransport(remotePlayerId);
+
+      if (session.isControlNext) {
+        readTransport(remotePlayerId);
+        session.isControlNext = false;
+        receiveSessionControl(data);
+      } else if (data == LINK_UNIVERSAL_SESSION_CONTROL) {
+        readTransport(remotePlayerId);
+        session.isControlNext = true;
+      } else if (session.isDiscarding) {
+        // (the messages after a gap are dropped until they're replayed)
+        readTransport(remotePlayerId);
+      } else {
         break;
+      }
+    }
+  }
+
+  void receiveSessionControl(u16 control) {
+    u32 type = control & LINK_UNIVERSAL_SESSION_TYPE_MASK;
+    u32 count = control & LINK_UNIVERSAL_SESSION_COUNT_MASK;
+
+    if (type == LINK_UNIVERSAL_SESSION_ACK) {
+      u32 seq = session.transmittedSeq -
+                ((session.transmittedSeq - count) &
+                 LINK_UNIVERSAL_SESSION_COUNT_MASK);
+      if (seq >= session.ackedSeq)
+        session.ackedSeq = seq;
+    } else if (type == LINK_UNIVERSAL_SESSION_RESUME) {
+      // (replay everything the remote player didn't receive, as long as it's
+      // still in the replay buffer)
+      u32 seq = session.nextSeq - ((session.nextSeq - count) &
+                                   LINK_UNIVERSAL_SESSION_COUNT_MASK);
+      if (session.nextSeq - seq <= LINK_UNIVERSAL_REPLAY_BUFFER_SIZE)
+        session.ackedSeq = seq;
+      session.transmittedSeq = session.ackedSeq;
+      session.isSeqPending = true;
+      session.isWaitingResume = false;
+    } else if (type == LINK_UNIVERSAL_SESSION_SEQ) {
+      // (checkpoints are read after all the previous messages, so the count
+      // must match; otherwise, some messages were lost in the transport)
+      if (count == (session.receivedSeq & LINK_UNIVERSAL_SESSION_COUNT_MASK)) {
+        session.isDiscarding = false;
+      } else if (!session.isDiscarding ||
+                 frameCount - session.lastResyncFrame >=
+                     LINK_UNIVERSAL_SESSION_RESYNC_FRAMES) {
+        if (!session.isDiscarding)
+          stats.resyncs++;
+        session.isDiscarding = true;
+        session.lastResyncFrame = frameCount;
+        sendSessionControl(LINK_UNIVERSAL_SESSION_RESUME, session.receivedSeq);
+        session.lastAckSeq = session.receivedSeq;
+      }
+    }
+  }
+
+  void flushSession(bool canAcknowledge = false) {
+    if (!flushSessionControl())
+      return;
+
+    u32 unacknowledged = session.receivedSeq - session.lastAckSeq;
+    if (canAcknowledge && unacknowledged > 0 &&
+        (frameCount - session.lastAckFrame >=
+             LINK_UNIVERSAL_SESSION_ACK_INTERVAL_FRAMES ||
+         unacknowledged >= LINK_UNIVERSAL_SESSION_WINDOW / 2)) {
+      sendSessionControl(LINK_UNIVERSAL_SESSION_ACK, session.receivedSeq);
+      session.lastAckSeq = session.receivedSeq;
+      session.lastAckFrame = frameCount;
+      if (!flushSessionControl())
+        return;
+    }
+
+    if (session.isWaitingResume)
+      return;
+
+    // (the remote player can't have more than a window of unread messages, so
+    // the transport's incoming queues never overflow)
+    while (session.transmittedSeq < session.nextSeq &&
+           session.transmittedSeq - session.ackedSeq <
+               LINK_UNIVERSAL_SESSION_WINDOW) {
+      if (session.isSeqPending ||
+          frameCount - session.lastSeqFrame >=
+              LINK_UNIVERSAL_SESSION_SEQ_INTERVAL_FRAMES) {
+        sendSessionControl(LINK_UNIVERSAL_SESSION_SEQ, session.transmittedSeq);
+        session.isSeqPending = false;
+        session.lastSeqFrame = frameCount;
+        if (!flushSessionControl())
+          return;
+      }
+
+      u16 data =
+          session.buffer[session.transmittedSeq %
+                         LINK_UNIVERSAL_REPLAY_BUFFER_SIZE];
+      if (!sendSessionWord(data))
+        return;
+      session.transmittedSeq++;
+    }
+  }
+
+  bool flushSessionControl() {
+    if (session.isMarkerPending) {
+      if (!sendSessionWord(LINK_UNIVERSAL_SESSION_CONTROL))
+        return false;
+      session.isMarkerPending = false;
+    }
+    if (session.pendingControl != 0) {
+      if (!sendSessionWord(session.pendingControl))
+        return false;
+      session.pendingControl = 0;
+    }
 
-      incomingMessages[message.playerId].push(message.data);
+    return true;
+  }
+
+  void sendSessionControl(u16 type, u32 seq) {
+    session.isMarkerPending = true;
+    session.pendingControl = type | (seq & LINK_UNIVERSAL_SESSION_COUNT_MASK);
+  }
+
+  bool sendSessionWord(u16 data) {
+    if (session.sendsThisFrame >= getMaxSendsPerFrame() ||
+        !sendToTransport(data))
+      return false;
+
+    session.sendsThisFrame++;
+    return true;
+  }
+
+  u32 getMaxSendsPerFrame() {
+    if (mode == LINK_WIRELESS)
+      return LINK_UNIVERSAL_MAX_SENDS_PER_FRAME;
+
+    // (the cable sends one message per timer interval)
+    u32 cyclesPerTransfer =
+        linkCable->config.interval * LINK_UNIVERSAL_CABLE_CYCLES_PER_TICK;
+    return max(LINK_UNIVERSAL_CYCLES_PER_FRAME / cyclesPerTransfer, 1);
+  }
+
+  bool sendToTransport(u16 data) {
+    if (mode == LINK_CABLE) {
+      // (a full cable queue would drop its oldest message)
+      if (!linkCable->canSend())
+        return false;
+
+      linkCable->send(data);
+      return true;
+    } else {
+      return linkWireless->send(data);
+    }
+  }
+
+  void resumeSession() {
+    if (!session.isActive) {
+      session = SessionState{};
+      session.isActive = true;
+      session.playerId = mode == LINK_CABLE ? linkCable->currentPlayerId()
+                                            : linkWireless->currentPlayerId();
     }
+
+    // (both players tell what they received, and wait for the other one
+    // before sending or replaying any data)
+    session.isFailingOver = false;
+    session.isWaitingResume = true;
+    session.isControlNext = false;
+    session.isDiscarding = false;
+    session.isSeqPending = true;
+    sendSessionControl(LINK_UNIVERSAL_SESSION_RESUME, session.receivedSeq);
+    session.lastAckSeq = session.receivedSeq;
+    flushSession();
+  }
+
+  void endSession() {
+    session.isActive = false;
+    session.isFailingOver = false;
+  }
+
+  void disconnect() {
+    stats.disconnections++;
+    emit(CONNECTION_LOST);
+
+    connectStartFrame = frameCount;
+    if (session.isActive) {
+      session.isFailingOver = true;
+      session.failoverStartFrame = frameCount;
+    }
+
+    toggleMode();
   }
 
   bool autoDiscoverWirelessConnections() {
     switch (linkWireless->getState()) {
-      case LinkWireless::State::NEEDS_RESET:
+      case LinkWireless::State::NEEDS_RESET: {
+        // (if the startup failed without ever finding an adapter, it's
+        // cheaper to go back to cable mode than to retry the login)
+        if (config.protocol == AUTODETECT && !isAdapterDetected)
+          return false;
+
+        linkWireless->activateAsync();
+        break;
+      }
+      case LinkWireless::State::STARTING: {
+        // (the adapter is being initialized by the interrupt handlers)
+        break;
+      }
       case LinkWireless::State::AUTHENTICATED: {
+        isAdapterDetected = true;
         subWaitCount = 0;
-        linkWireless->getServersAsyncStart();
+
+        if (!didTryCachedRoom && config.protocol != WIRELESS_SERVER) {
+          // (fast path: join a room seen in a recent scan, without searching)
+          didTryCachedRoom = true;
+          LinkWireless::Server servers[LINK_WIRELESS_MAX_SERVERS];
+          linkWireless->getCachedServers(
+              servers, LINK_UNIVERSAL_CACHED_ROOM_MAX_AGE_FRAMES);
+
+          u32 serverIndex = 0;
+          if (findBestRoom(servers, serverIndex)) {
+            if (!linkWireless->connect(servers[serverIndex].id))
+              return false;
+            emit(JOINING);
+            break;
+          }
+        }
+
+        if (linkWireless->getServersAsyncStart()) {
+          stats.searches++;
+          emit(SEARCHING);
+        }
         break;
       }
       case LinkWireless::State::SEARCHING: {
         waitCount = 0;
         subWaitCount++;
 
-        if (subWaitCount >= LINK_UNIVERSAL_BROADCAST_SEARCH_WAIT_FRAMES) {
+        bool foundRoom = false;
+        if (!linkWireless->pollServers(
+                [this, &foundRoom](LinkWireless::ServerEvent event,
+                                   LinkWireless::Server server) {
+                  if (event == LinkWireless::ServerEvent::SERVER_APPEARED &&
+                      getRoomScore(server) > 0 &&
+                      config.protocol != WIRELESS_SERVER)
+                    foundRoom = true;
+                }))
+          return false;
+
+        if (foundRoom ||
+            subWaitCount >= LINK_UNIVERSAL_BROADCAST_SEARCH_WAIT_FRAMES) {
           if (!tryConnectOrServeWirelessSession())
             return false;
         }
@@ -376,7 +833,8 @@ class LinkUniversal {
 
         break;
       }
-      case LinkWireless::State::CONNECTED: {
+      case LinkWireless::State::CONNECTED:
+      case LinkWireless::State::RESUMING: {
         // (should not happen)
         break;
       }
@@ -389,30 +847,14 @@ class LinkUniversal {
     LinkWireless::Server servers[LINK_WIRELESS_MAX_SERVERS];
     if (!linkWireless->getServersAsyncEnd(servers))
       return false;
+    didTryCachedRoom = false;
 
-    u32 maxRandomNumber = 0;
     u32 serverIndex = 0;
-    for (u32 i = 0; i < LINK_WIRELESS_MAX_SERVERS; i++) {
-      auto server = servers[i];
-      if (server.id == LINK_WIRELESS_END)
-        break;
-
-      if (!server.isFull() &&
-          std::strcmp(server.gameName, config.gameName) == 0 &&
-          (LINK_UNIVERSAL_GAME_ID_FILTER == 0 ||
-           server.gameId == LINK_UNIVERSAL_GAME_ID_FILTER)) {
-        u32 randomNumber = safeStoi(server.userName);
-        if (randomNumber > maxRandomNumber &&
-            randomNumber < LINK_UNIVERSAL_MAX_ROOM_NUMBER) {
-          maxRandomNumber = randomNumber;
-          serverIndex = i;
-        }
-      }
-    }
-
-    if (maxRandomNumber > 0 && config.protocol != WIRELESS_SERVER) {
+    if (findBestRoom(servers, serverIndex) &&
+        config.protocol != WIRELESS_SERVER) {
       if (!linkWireless->connect(servers[serverIndex].id))
         return false;
+      emit(JOINING);
     } else {
       if (config.protocol == WIRELESS_CLIENT)
         return false;
@@ -425,15 +867,59 @@ class LinkUniversal {
       std::snprintf(randomNumberStr, sizeof(randomNumberStr), "%d",
                     randomNumber);
       if (!linkWireless->serve(config.gameName, randomNumberStr,
-                               LINK_UNIVERSAL_GAME_ID_FILTER > 0
-                                   ? LINK_UNIVERSAL_GAME_ID_FILTER
+                               config.roomFilter.gameId > 0
+                                   ? config.roomFilter.gameId
                                    : LINK_WIRELESS_MAX_GAME_ID))
         return false;
+      stats.serves++;
+      emit(SERVING);
     }
 
     return true;
   }
 
+  bool findBestRoom(LinkWireless::Server servers[], u32& serverIndex) {
+    u32 maxScore = 0;
+    for (u32 i = 0; i < LINK_WIRELESS_MAX_SERVERS; i++) {
+      auto& server = servers[i];
+      if (server.id == LINK_WIRELESS_END)
+        break;
+
+      u32 score = getRoomScore(server);
+      if (score > maxScore) {
+        maxScore = score;
+        serverIndex = i;
+      }
+    }
+
+    return maxScore > 0;
+  }
+
+  u32 getRoomScore(LinkWireless::Server& server) {
+    // (rooms closer to full come first, so groups consolidate faster;
+    // ties are broken by the random room number, like every console does)
+    u32 roomNumber = getRoomNumber(server);
+    if (roomNumber == 0)
+      return 0;
+
+    return server.currentPlayerCount * LINK_UNIVERSAL_MAX_ROOM_NUMBER +
+           roomNumber;
+  }
+
+  u32 getRoomNumber(LinkWireless::Server& server) {
+    auto& filter = config.roomFilter;
+    if (server.isFull() ||
+        (filter.matchGameName &&
+         std::strcmp(server.gameName, config.gameName) != 0) ||
+        (filter.gameId != 0 && server.gameId != filter.gameId) ||
+        server.currentPlayerCount < filter.minPlayers ||
+        server.currentPlayerCount > filter.maxPlayers)
+      return 0;
+
+    u32 randomNumber = safeStoi(server.userName);
+    return randomNumber < LINK_UNIVERSAL_MAX_ROOM_NUMBER ? randomNumber : 0;
+  }
+
   bool isConnectedCable() { return linkCable->isConnected(); }
   bool isConnectedWireless() { return linkWireless->isConnected(); }
 
@@ -463,6 +949,12 @@ class LinkUniversal {
   void toggleMode() {
     switch (config.protocol) {
       case AUTODETECT: {
+        if (mode == LINK_WIRELESS && isAdapterDetected) {
+          // (there's an adapter, so there can't be a cable)
+          restartWireless();
+          break;
+        }
+
         setMode(mode == LINK_CABLE ? LINK_WIRELESS : LINK_CABLE);
         break;
       }
@@ -473,24 +965,56 @@ class LinkUniversal {
       case WIRELESS_AUTO:
       case WIRELESS_SERVER:
       case WIRELESS_CLIENT: {
-        setMode(LINK_WIRELESS);
+        restartWireless();
         break;
       }
     }
   }
 
+  void restartWireless() {
+    if (mode != LINK_WIRELESS) {
+      setMode(LINK_WIRELESS);
+      return;
+    }
+
+    // (the adapter is reset by `activateAsync()`, no need to deactivate it)
+    start();
+  }
+
+  void setConnected() {
+    state = CONNECTED;
+    lastPlayerCount = getTransportPlayerCount();
+    stats.connections++;
+    stats.lastConnectionFrames = frameCount - connectStartFrame;
+    stats.totalConnectionFrames += stats.lastConnectionFrames;
+    emit(CONNECTION_ESTABLISHED);
+
+    if (config.failover)
+      resumeSession();
+  }
+
   void setMode(Mode mode) {
+    bool didSwitch = mode != this->mode;
     stop();
     this->state = INITIALIZING;
     this->mode = mode;
+    isAdapterDetected = false;
     resetState();
+
+    if (didSwitch) {
+      stats.modeSwitches++;
+      emit(MODE_SWITCHED);
+    }
   }
 
   void start() {
-    if (mode == LINK_CABLE)
+    stats.attempts++;
+
+    if (mode == LINK_CABLE) {
       linkCable->activate();
-    else
-      linkWireless->activate();
+    } else {
+      linkWireless->activateAsync();
+    }
 
     state = WAITING;
     resetState();
@@ -502,8 +1026,7 @@ class LinkUniversal {
                  qran_range(1, LINK_UNIVERSAL_SWITCH_WAIT_FRAMES_RANDOM);
     subWaitCount = 0;
     serveWait = 0;
-    for (u32 i = 0; i < LINK_UNIVERSAL_MAX_PLAYERS; i++)
-      incomingMessages[i].clear();
+    cableHintCount = 0;
   }
 
   u32 safeStoi(const char* str) {
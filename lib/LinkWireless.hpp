@@ -36,6 +36,8 @@
 //       // `playerCount()` should return the number of active consoles
 // - 6) Send data:
 //       linkWireless->send(0x1234);
+//       // (or, from the server, to a single client)
+//       linkWireless->sendTo(2, 0x1234);
 // - 7) Receive data:
 //       LinkWireless::Message messages[LINK_WIRELESS_QUEUE_SIZE];
 //       linkWireless->receive(messages);
@@ -66,6 +68,11 @@
 // Buffer size
 #define LINK_WIRELESS_QUEUE_SIZE 30
 
+// Buffer size of each queue (by default, all of them use the one above)
+#define LINK_WIRELESS_INCOMING_QUEUE_SIZE LINK_WIRELESS_QUEUE_SIZE
+#define LINK_WIRELESS_OUTGOING_QUEUE_SIZE LINK_WIRELESS_QUEUE_SIZE
+#define LINK_WIRELESS_FORWARDED_QUEUE_SIZE LINK_WIRELESS_QUEUE_SIZE
+
 // Max server transfer length
 #define LINK_WIRELESS_MAX_SERVER_TRANSFER_LENGTH 20
 
@@ -75,9 +82,6 @@
 // Put Interrupt Service Routines (ISR) in IWRAM (uncomment to enable)
 // #define LINK_WIRELESS_PUT_ISR_IN_IWRAM
 
-// Use send/receive latch (uncomment to enable)
-// #define LINK_WIRELESS_USE_SEND_RECEIVE_LATCH
-
 #define LINK_WIRELESS_MAX_PLAYERS 5
 #define LINK_WIRELESS_MIN_PLAYERS 2
 #define LINK_WIRELESS_END 0
@@ -93,17 +97,48 @@
 #define LINK_WIRELESS_MSG_PING 0xffff
 #define LINK_WIRELESS_PING_WAIT 50
 #define LINK_WIRELESS_TRANSFER_WAIT 15
+#define LINK_WIRELESS_IDLE_KEEPALIVE_FRAMES 2
 #define LINK_WIRELESS_BROADCAST_SEARCH_WAIT_FRAMES 60
+#define LINK_WIRELESS_BROADCAST_POLL_INTERVAL_FRAMES 6
+#define LINK_WIRELESS_SERVER_CACHE_TTL_FRAMES 120
 #define LINK_WIRELESS_CMD_TIMEOUT 100
+#define LINK_WIRELESS_START_TIMEOUT_FRAMES 30
+#define LINK_WIRELESS_RESUME_TIMEOUT_FRAMES 180
+#define LINK_WIRELESS_RESUME_CONNECT_POLLS 10
+#define LINK_WIRELESS_MAX_COMMAND_RETRIES 3
+#define LINK_WIRELESS_LINES_PER_FRAME 228
+#define LINK_WIRELESS_CYCLES_PER_TICK 1024
+#define LINK_WIRELESS_CYCLES_PER_LINE 1232
+#define LINK_WIRELESS_CYCLES_PER_FRAME 280896
+#define LINK_WIRELESS_PROFILER_BUCKETS 8
+#define LINK_WIRELESS_PROFILER_FIRST_BUCKET_BITS 8
 #define LINK_WIRELESS_MAX_COMMAND_RESPONSE_LENGTH 30
+#define LINK_WIRELESS_MAX_QUEUED_COMMANDS 4
+#define LINK_WIRELESS_CLOCK_SYNC_INTERVAL_FRAMES 60
+#define LINK_WIRELESS_SIGNAL_LEVEL_INTERVAL_FRAMES 30
+#define LINK_WIRELESS_CLOCK_SYNC_MAX_DELAY_LINES 1140
+#define LINK_WIRELESS_CLOCK_SYNC_REQUEST 5
+#define LINK_WIRELESS_CLOCK_SYNC_RESPONSE 6
+#define LINK_WIRELESS_CLOCK_SYNC_LOW_BITS 21
+#define LINK_WIRELESS_CLOCK_SYNC_HIGH_PART_BIT 21
+#define LINK_WIRELESS_ALL_PLAYERS 0xff
+#define LINK_WIRELESS_NO_SLOT 0xff
+#define LINK_WIRELESS_MESSAGE_RUN 7
+#define LINK_WIRELESS_MESSAGE_RUN_COUNT_BITS 6
+#define LINK_WIRELESS_MESSAGE_RUN_MAX_MESSAGES \
+  ((1 << LINK_WIRELESS_MESSAGE_RUN_COUNT_BITS) - 1)
+#define LINK_WIRELESS_MESSAGE_RUN_ORIGIN_BIT 10
 #define LINK_WIRELESS_MAX_GAME_ID 0x7fff
-#define LINK_WIRELESS_MAX_GAME_NAME_LENGTH 14
+#define LINK_WIRELESS_MAX_GAME_NAME_LENGTH 12
+#define LINK_WIRELESS_PROTOCOL_VERSION 2
+#define LINK_WIRELESS_PROTOCOL_TAG (0x80 | LINK_WIRELESS_PROTOCOL_VERSION)
 #define LINK_WIRELESS_MAX_USER_NAME_LENGTH 8
 #define LINK_WIRELESS_LOGIN_STEPS 9
 #define LINK_WIRELESS_COMMAND_HEADER 0x9966
 #define LINK_WIRELESS_RESPONSE_ACK 0x80
 #define LINK_WIRELESS_DATA_REQUEST 0x80000000
 #define LINK_WIRELESS_SETUP_MAGIC 0x003c0420
+#define LINK_WIRELESS_WAIT_TIMEOUT_FRAMES (LINK_WIRELESS_SETUP_MAGIC & 0xff)
 #define LINK_WIRELESS_SETUP_MAX_PLAYERS_BIT 16
 #define LINK_WIRELESS_STILL_CONNECTING 0x01000000
 #define LINK_WIRELESS_BROADCAST_LENGTH 6
@@ -115,6 +150,7 @@
    LINK_WIRELESS_BROADCAST_RESPONSE_LENGTH)
 #define LINK_WIRELESS_COMMAND_HELLO 0x10
 #define LINK_WIRELESS_COMMAND_SETUP 0x17
+#define LINK_WIRELESS_COMMAND_SIGNAL_LEVEL 0x11
 #define LINK_WIRELESS_COMMAND_BROADCAST 0x16
 #define LINK_WIRELESS_COMMAND_START_HOST 0x19
 #define LINK_WIRELESS_COMMAND_ACCEPT_CONNECTIONS 0x1a
@@ -125,21 +161,32 @@
 #define LINK_WIRELESS_COMMAND_IS_FINISHED_CONNECT 0x20
 #define LINK_WIRELESS_COMMAND_FINISH_CONNECTION 0x21
 #define LINK_WIRELESS_COMMAND_SEND_DATA 0x24
+#define LINK_WIRELESS_COMMAND_SEND_DATA_AND_WAIT 0x25
 #define LINK_WIRELESS_COMMAND_RECEIVE_DATA 0x26
+#define LINK_WIRELESS_EVENT_WAIT_TIMEOUT 0x27
+#define LINK_WIRELESS_EVENT_DATA_AVAILABLE 0x28
+#define LINK_WIRELESS_EVENT_DISCONNECTED 0x29
 #define LINK_WIRELESS_COMMAND_BYE 0x3d
+#define LINK_WIRELESS_COMMAND_TRANSFER 0x00
 #define LINK_WIRELESS_BARRIER asm volatile("" ::: "memory")
 #define LINK_WIRELESS_CODE_IWRAM \
   __attribute__((section(".iwram"), target("arm"), noinline))
+#define LINK_WIRELESS_DATA_IWRAM __attribute__((section(".iwram")))
+#define LINK_WIRELESS_DATA_EWRAM __attribute__((section(".ewram")))
 #define LINK_WIRELESS_ALWAYS_INLINE inline __attribute__((always_inline))
 
 #define LINK_WIRELESS_RESET_IF_NEEDED \
   if (!isEnabled)                     \
     return false;                     \
+  if (state == STARTING) {            \
+    lastError = WRONG_STATE;          \
+    return false;                     \
+  }                                   \
   if (state == NEEDS_RESET)           \
     if (!reset())                     \
       return false;
 
-static volatile char LINK_WIRELESS_VERSION[] = "LinkWireless/v6.3.0";
+static volatile char LINK_WIRELESS_VERSION[] = "LinkWireless/v7.0.0";
 
 void LINK_WIRELESS_ISR_VBLANK();
 void LINK_WIRELESS_ISR_SERIAL();
@@ -152,27 +199,16 @@ const u16 LINK_WIRELESS_TIMER_IRQ_IDS[] = {IRQ_TIMER0, IRQ_TIMER1, IRQ_TIMER2,
 class LinkWireless {
  public:
 // std::function<void(std::string str)> debug;
-// #define PROFILING_ENABLED
-#ifdef PROFILING_ENABLED
-  u32 lastVBlankTime = 0;
-  u32 lastSerialTime = 0;
-  u32 lastTimerTime = 0;
-  u32 lastACKTimerTime = 0;
-  u32 lastFrameSerialIRQs = 0;
-  u32 lastFrameTimerIRQs = 0;
-  u32 lastFrameACKTimerIRQs = 0;
-  u32 serialIRQCount = 0;
-  u32 timerIRQCount = 0;
-  u32 ackTimerIRQCount = 0;
-#endif
 
   enum State {
     NEEDS_RESET,
+    STARTING,
     AUTHENTICATED,
     SEARCHING,
     SERVING,
     CONNECTING,
-    CONNECTED
+    CONNECTED,
+    RESUMING
   };
 
   enum Error {
@@ -189,7 +225,9 @@ class LinkWireless {
     RECEIVE_DATA_FAILED = 8,
     ACKNOWLEDGE_FAILED = 9,
     TIMEOUT = 10,
-    REMOTE_TIMEOUT = 11
+    REMOTE_TIMEOUT = 11,
+    DISCONNECTED = 12,
+    INVALID_PLAYER_ID = 13
   };
 
   struct Message {
@@ -197,14 +235,21 @@ class LinkWireless {
 
     u16 data;
     u8 playerId = 0;
+    u8 targetId = LINK_WIRELESS_ALL_PLAYERS;
   };
 
+  enum ServerEvent { SERVER_APPEARED, SERVER_DISAPPEARED };
+
+  enum TransferStrategy { CHAINED, LATCH, ADAPTIVE };
+
   struct Server {
     u16 id = 0;
     u16 gameId;
     char gameName[LINK_WIRELESS_MAX_GAME_NAME_LENGTH + 1];
     char userName[LINK_WIRELESS_MAX_USER_NAME_LENGTH + 1];
     u8 currentPlayerCount;
+    u8 sessionNonce = 0;
+    u32 lastSeenFrame = 0;
 
     bool isFull() { return currentPlayerCount == 0; }
   };
@@ -242,6 +287,19 @@ class LinkWireless {
     return success;
   }
 
+  void activateAsync() {
+    lastError = NONE;
+    isEnabled = false;
+
+    LINK_WIRELESS_BARRIER;
+    resetState();
+    stop();
+    startAsync();
+    LINK_WIRELESS_BARRIER;
+
+    isEnabled = true;
+  }
+
   bool deactivate() {
     activate();
     bool success = sendCommand(LINK_WIRELESS_COMMAND_BYE).success;
@@ -276,8 +334,10 @@ class LinkWireless {
     copyName(finalGameName, gameName, LINK_WIRELESS_MAX_GAME_NAME_LENGTH);
     copyName(finalUserName, userName, LINK_WIRELESS_MAX_USER_NAME_LENGTH);
 
-    if (state != SERVING)
+    if (state != SERVING) {
       setup(config.maxPlayers);
+      resume.nonce = (u8)(frameCount ^ (frameCount >> 8) ^ REG_VCOUNT);
+    }
 
     addData(buildU32(buildU16(finalGameName[1], finalGameName[0]),
                      gameId & LINK_WIRELESS_MAX_GAME_ID),
@@ -286,12 +346,17 @@ class LinkWireless {
                      buildU16(finalGameName[3], finalGameName[2])));
     addData(buildU32(buildU16(finalGameName[9], finalGameName[8]),
                      buildU16(finalGameName[7], finalGameName[6])));
-    addData(buildU32(buildU16(finalGameName[13], finalGameName[12]),
+    // (the last two game name bytes hold the protocol tag, so servers from
+    // incompatible versions are ignored, and a random session nonce, so
+    // resuming clients don't join a different room with the same names)
+    addData(buildU32(buildU16(resume.nonce, LINK_WIRELESS_PROTOCOL_TAG),
                      buildU16(finalGameName[11], finalGameName[10])));
     addData(buildU32(buildU16(finalUserName[3], finalUserName[2]),
                      buildU16(finalUserName[1], finalUserName[0])));
     addData(buildU32(buildU16(finalUserName[7], finalUserName[6]),
                      buildU16(finalUserName[5], finalUserName[4])));
+    for (u32 i = 0; i < LINK_WIRELESS_BROADCAST_LENGTH; i++)
+      resume.broadcastData[i] = nextCommandData[i];
 
     bool success = sendCommand(LINK_WIRELESS_COMMAND_BROADCAST, true).success;
 
@@ -345,11 +410,63 @@ class LinkWireless {
       return false;
     }
 
+    lastServerPollFrame = frameCount;
     state = SEARCHING;
 
     return true;
   }
 
+  bool pollServers() {
+    return pollServers([](ServerEvent, Server) {});
+  }
+
+  template <typename F>
+  bool pollServers(F onEvent) {
+    LINK_WIRELESS_RESET_IF_NEEDED
+    if (state != SEARCHING) {
+      lastError = WRONG_STATE;
+      return false;
+    }
+
+    if (frameCount - lastServerPollFrame <
+        LINK_WIRELESS_BROADCAST_POLL_INTERVAL_FRAMES)
+      return true;
+
+    auto result = sendCommand(LINK_WIRELESS_COMMAND_BROADCAST_READ_POLL);
+    bool success =
+        result.success &&
+        result.responsesSize % LINK_WIRELESS_BROADCAST_RESPONSE_LENGTH == 0;
+
+    if (!success) {
+      reset();
+      lastError = COMMAND_FAILED;
+      return false;
+    }
+
+    Server servers[LINK_WIRELESS_MAX_SERVERS];
+    u32 totalServers = parseServers(result, servers);
+    updateServerCache(servers, totalServers, onEvent);
+    lastServerPollFrame = frameCount;
+
+    return true;
+  }
+
+  void getCachedServers(Server servers[], u32 maxAgeFrames = 0xffffffff) {
+    u32 i = 0;
+    for (u32 j = 0; j < LINK_WIRELESS_MAX_SERVERS; j++) {
+      if (serverCache[j].id != LINK_WIRELESS_END &&
+          frameCount - serverCache[j].lastSeenFrame <= maxAgeFrames)
+        servers[i++] = serverCache[j];
+    }
+    for (; i < LINK_WIRELESS_MAX_SERVERS; i++)
+      servers[i] = Server{};
+  }
+
+  void clearServerCache() {
+    for (u32 i = 0; i < LINK_WIRELESS_MAX_SERVERS; i++)
+      serverCache[i] = Server{};
+  }
+
   bool getServersAsyncEnd(Server servers[]) {
     LINK_WIRELESS_RESET_IF_NEEDED
     if (state != SEARCHING) {
@@ -377,30 +494,8 @@ class LinkWireless {
       return false;
     }
 
-    u32 totalBroadcasts =
-        result.responsesSize / LINK_WIRELESS_BROADCAST_RESPONSE_LENGTH;
-
-    for (u32 i = 0; i < totalBroadcasts; i++) {
-      u32 start = LINK_WIRELESS_BROADCAST_RESPONSE_LENGTH * i;
-
-      Server server;
-      server.id = (u16)result.responses[start];
-      server.gameId = result.responses[start + 1] & LINK_WIRELESS_MAX_GAME_ID;
-      u32 gameI = 0, userI = 0;
-      recoverName(server.gameName, gameI, result.responses[start + 1], false);
-      recoverName(server.gameName, gameI, result.responses[start + 2]);
-      recoverName(server.gameName, gameI, result.responses[start + 3]);
-      recoverName(server.gameName, gameI, result.responses[start + 4]);
-      recoverName(server.userName, userI, result.responses[start + 5]);
-      recoverName(server.userName, userI, result.responses[start + 6]);
-      server.gameName[gameI] = '\0';
-      server.userName[userI] = '\0';
-      u8 connectedClients = (result.responses[start] >> 16) & 0xff;
-      server.currentPlayerCount =
-          connectedClients == 0xff ? 0 : (1 + connectedClients);
-
-      servers[i] = server;
-    }
+    u32 totalServers = parseServers(result, servers);
+    updateServerCache(servers, totalServers, [](ServerEvent, Server) {});
 
     state = AUTHENTICATED;
 
@@ -423,6 +518,12 @@ class LinkWireless {
       return false;
     }
 
+    resume.server = Server{};
+    for (u32 i = 0; i < LINK_WIRELESS_MAX_SERVERS; i++) {
+      if (serverCache[i].id == serverId)
+        resume.server = serverCache[i];
+    }
+    resume.serverId = serverId;
     state = CONNECTING;
 
     return true;
@@ -465,22 +566,37 @@ class LinkWireless {
     return true;
   }
 
-  bool send(u16 data, int _author = -1) {
+  bool send(u16 data) { return _send(data, LINK_WIRELESS_ALL_PLAYERS); }
+
+  bool sendTo(u8 playerId, u16 data) {
+    if (state == CONNECTED || (state == RESUMING && !resume.isServer)) {
+      lastError = WRONG_STATE;
+      return false;
+    }
+    if (playerId == 0 || playerId >= config.maxPlayers) {
+      lastError = INVALID_PLAYER_ID;
+      return false;
+    }
+
+    return _send(data, playerId);
+  }
+
+  bool _send(u16 data, u8 targetId) {
     LINK_WIRELESS_RESET_IF_NEEDED
-    if (!isSessionActive()) {
+    if (!isSessionActive() && state != RESUMING) {
       lastError = WRONG_STATE;
       return false;
     }
 
     if (!_canSend()) {
-      if (_author < 0)
-        lastError = BUFFER_IS_FULL;
+      lastError = BUFFER_IS_FULL;
       return false;
     }
 
     Message message;
-    message.playerId = _author >= 0 ? _author : sessionState.currentPlayerId;
+    message.playerId = sessionState.currentPlayerId;
     message.data = data;
+    message.targetId = targetId;
 
     LINK_WIRELESS_BARRIER;
     isAddingMessage = true;
@@ -501,20 +617,30 @@ class LinkWireless {
   }
 
   bool receive(Message messages[]) {
-    if (!isEnabled || state == NEEDS_RESET || !isSessionActive())
+    u32 i = 0;
+
+    return receive([&messages, &i](const Message& message) {
+      if (i == LINK_WIRELESS_QUEUE_SIZE)
+        return false;
+
+      messages[i] = message;
+      i++;
+      return true;
+    });
+  }
+
+  template <typename F>
+  bool receive(F onMessage) {
+    if (!isEnabled || (!isSessionActive() && state != RESUMING))
       return false;
 
     LINK_WIRELESS_BARRIER;
     isReadingMessages = true;
     LINK_WIRELESS_BARRIER;
 
-    u32 i = 0;
-    while (!sessionState.incomingMessages.isEmpty()) {
-      auto message = sessionState.incomingMessages.pop();
-      messages[i] = message;
-      forwardMessageIfNeeded(message);
-      i++;
-    }
+    // (messages are read from the queue itself; returning `false` stops the
+    // iteration and leaves the current message in the queue)
+    sessionState.incomingMessages.consume(onMessage);
 
     LINK_WIRELESS_BARRIER;
     isReadingMessages = false;
@@ -523,11 +649,104 @@ class LinkWireless {
     return true;
   }
 
+  bool canRead(u8 playerId) {
+    if (playerId >= LINK_WIRELESS_MAX_PLAYERS)
+      return false;
+
+    return !sessionState.incomingMessages.isEmpty(playerId);
+  }
+
+  u16 peek(u8 playerId) {
+    if (!canRead(playerId))
+      return 0;
+
+    return sessionState.incomingMessages.peek(playerId).data;
+  }
+
+  u16 read(u8 playerId) {
+    if (!isEnabled || !canRead(playerId))
+      return 0;
+
+    LINK_WIRELESS_BARRIER;
+    isReadingMessages = true;
+    LINK_WIRELESS_BARRIER;
+
+    u16 data = sessionState.incomingMessages.pop(playerId).data;
+
+    LINK_WIRELESS_BARRIER;
+    isReadingMessages = false;
+    LINK_WIRELESS_BARRIER;
+
+    return data;
+  }
+
   State getState() { return state; }
-  bool isConnected() { return sessionState.playerCount > 1; }
+  bool isConnected() {
+    return sessionState.playerCount > 1 && state != RESUMING;
+  }
   bool isSessionActive() { return state == SERVING || state == CONNECTED; }
+  bool isResuming() { return state == RESUMING; }
   u8 playerCount() { return sessionState.playerCount; }
   u8 currentPlayerId() { return sessionState.currentPlayerId; }
+  u32 getStartupFrames() { return startupFrames; }
+
+  struct ClockSync {
+    s32 offset = 0;    // (lines to add to the local time)
+    s32 drift = 0;     // (in ppm)
+    u32 delay = 0;     // (round trip of the last sample, in lines)
+    u32 samples = 0;
+  };
+
+  u32 getLocalTime() {
+    // (vertical lines since activation; VBlank starts at line 160)
+    u32 frames, vCount;
+    bool isVBlankPending;
+    do {
+      frames = frameCount;
+      vCount = REG_VCOUNT;
+      isVBlankPending = (REG_IE & IRQ_VBLANK) && (REG_IF & IRQ_VBLANK);
+    } while (frames != frameCount);
+
+    // (between line 160 and the VBlank handler, `frameCount` is one behind)
+    if (vCount >= 160 && isVBlankPending)
+      frames++;
+
+    return frames * LINK_WIRELESS_LINES_PER_FRAME +
+           (vCount + LINK_WIRELESS_LINES_PER_FRAME - 160) % LINK_WIRELESS_LINES_PER_FRAME;
+  }
+
+  u32 getSharedTime() {
+    u32 localTime = getLocalTime();
+    if (state == SERVING || clock.sync.samples == 0)
+      return localTime;
+
+    s32 elapsed = localTime - clock.lastSampleTime;
+    return localTime + clock.sync.offset +
+           (s32)(((s64)clock.sync.drift * elapsed) / 1000000);
+  }
+
+  bool isClockSynced() {
+    return state == SERVING || (state == CONNECTED && clock.sync.samples > 0);
+  }
+
+  ClockSync getClockSync() { return clock.sync; }
+
+  u8 getSignalLevel(u8 playerId) {
+    return playerId < LINK_WIRELESS_MAX_PLAYERS
+               ? sessionState.signalLevels[playerId]
+               : 0;
+  }
+
+  u8 getLowestSignalLevel() {
+    if (state == CONNECTED)
+      return sessionState.signalLevels[sessionState.currentPlayerId];
+
+    u8 lowest = 0xff;
+    for (u32 i = 1; i < sessionState.playerCount; i++)
+      lowest = min(lowest, sessionState.signalLevels[i]);
+    return sessionState.playerCount > 1 ? lowest : 0;
+  }
+
   Error getLastError(bool clear = true) {
     Error error = lastError;
     if (clear)
@@ -535,11 +754,6 @@ class LinkWireless {
     return error;
   }
 
-  ~LinkWireless() {
-    delete linkSPI;
-    delete linkGPIO;
-  }
-
   bool _hasActiveAsyncCommand() { return asyncCommand.isActive; }
   bool _canSend() { return !sessionState.outgoingMessages.isFull(); }
   u32 _getPendingCount() { return sessionState.outgoingMessages.size(); }
@@ -561,44 +775,21 @@ class LinkWireless {
   }
 
   void _onVBlank() {
-    if (!isEnabled)
-      return;
+    frameCount++;
 
-#ifdef PROFILING_ENABLED
-    profileStart();
-#endif
-
-    if (!isSessionActive())
+    if (!isEnabled)
       return;
 
-    if (isConnected() && sessionState.frameRecvCount == 0)
-      sessionState.recvTimeout++;
-
-    if (sessionState.recvTimeout >= config.timeout) {
-      reset();
-      lastError = TIMEOUT;
-      return;
-    }
+    u32 startTime = profileStart();
+    handleVBlank();
+    profileStop(profiler.vBlank, startTime);
 
-    if (!checkRemoteTimeouts()) {
-      reset();
-      lastError = REMOTE_TIMEOUT;
-      return;
+    if (profilerTimerId > -1) {
+      profiler.lastFrameCycles = profiler.currentFrameCycles;
+      profiler.maxFrameCycles =
+          max(profiler.maxFrameCycles, profiler.lastFrameCycles);
+      profiler.currentFrameCycles = 0;
     }
-
-    sessionState.frameRecvCount = 0;
-    sessionState.acceptCalled = false;
-    sessionState.pingSent = false;
-
-#ifdef PROFILING_ENABLED
-    lastVBlankTime = profileStop();
-    lastFrameSerialIRQs = serialIRQCount;
-    lastFrameTimerIRQs = timerIRQCount;
-    lastFrameACKTimerIRQs = ackTimerIRQCount;
-    serialIRQCount = 0;
-    timerIRQCount = 0;
-    ackTimerIRQCount = 0;
-#endif
   }
 
 #ifdef LINK_WIRELESS_PUT_ISR_IN_IWRAM
@@ -616,111 +807,149 @@ class LinkWireless {
     if (!isEnabled)
       return;
 
-#ifdef PROFILING_ENABLED
-    profileStart();
-#endif
+    u32 startTime = profileStart();
+    handleSerial();
+    profileStop(profiler.serial, startTime);
+  }
 
-    linkSPI->_onSerial(true);
+  LINK_WIRELESS_ALWAYS_INLINE void __onTimer() {
+    if (!isEnabled)
+      return;
 
-    bool hasNewData = linkSPI->getAsyncState() == LinkSPI::AsyncState::READY;
-    if (!usesAsyncACK()) {
-      if (hasNewData) {
-        if (!acknowledge()) {
-          reset();
-          lastError = ACKNOWLEDGE_FAILED;
-          return;
-        }
-      } else
-        return;
-    }
-    u32 newData = linkSPI->getAsyncData();
+    u32 startTime = profileStart();
+    handleTimer();
+    profileStop(profiler.timer, startTime);
+  }
 
-    if (!isSessionActive())
+  LINK_WIRELESS_ALWAYS_INLINE void __onACKTimer() {
+    if (!isEnabled || linkSPI.getHandshakeState() !=
+                          LinkSPI::HandshakeState::HANDSHAKE_WAITING)
       return;
 
-    if (asyncCommand.isActive) {
-      if (usesAsyncACK()) {
-        if (asyncCommand.ackStep != AsyncCommand::ACKStep::READY)
-          return;
+    u32 startTime = profileStart();
+    handleACKTimer();
+    profileStop(profiler.ackTimer, startTime);
+  }
 
-        if (hasNewData) {
-          linkSPI->_setSOLow();
-          asyncCommand.ackStep = AsyncCommand::ACKStep::WAITING_FOR_HIGH;
-          asyncCommand.pendingData = newData;
-          startACKTimer();
-        } else
-          return;
-      } else {
-        if (asyncCommand.state == AsyncCommand::State::PENDING) {
-          updateAsyncCommand(newData);
+  struct ProfilerStats {
+    u32 count = 0;
+    u32 min = 0;
+    u32 max = 0;
+    u64 total = 0;
+    u32 histogram[LINK_WIRELESS_PROFILER_BUCKETS] = {};
+
+    u32 mean() { return count > 0 ? (u32)(total / count) : 0; }
+
+    void add(u32 cycles) {  // (irq only)
+      if (count == 0 || cycles < min)
+        min = cycles;
+      if (cycles > max)
+        max = cycles;
+      total += cycles;
+      count++;
 
-          if (asyncCommand.state == AsyncCommand::State::COMPLETED)
-            processAsyncCommand();
-        }
+      u32 bucket = 0;
+      cycles >>= LINK_WIRELESS_PROFILER_FIRST_BUCKET_BITS;
+      while (cycles > 0 && bucket < LINK_WIRELESS_PROFILER_BUCKETS - 1) {
+        cycles >>= 1;
+        bucket++;
       }
+      histogram[bucket]++;
     }
+  };
 
-#ifdef PROFILING_ENABLED
-    lastSerialTime = profileStop();
-    serialIRQCount++;
-#endif
-  }
+  struct Profiler {
+    ProfilerStats vBlank;
+    ProfilerStats serial;
+    ProfilerStats timer;
+    ProfilerStats ackTimer;
+    ProfilerStats sendData;
+    ProfilerStats receiveData;
+    ProfilerStats acceptConnections;
+    u32 lastFrameCycles = 0;
+    u32 maxFrameCycles = 0;
+    u32 currentFrameCycles = 0;
+
+    u32 lastFrameUsage() {
+      return (lastFrameCycles * 100) / LINK_WIRELESS_CYCLES_PER_FRAME;
+    }
+    u32 maxFrameUsage() {
+      return (maxFrameCycles * 100) / LINK_WIRELESS_CYCLES_PER_FRAME;
+    }
+  };
 
-  LINK_WIRELESS_ALWAYS_INLINE void __onTimer() {
-    if (!isEnabled)
-      return;
+  bool activateProfiler(u8 timerId) {
+    if (timerId > 2 || isTimerUsed(timerId) || isTimerUsed(timerId + 1))
+      return false;
 
-#ifdef PROFILING_ENABLED
-    profileStart();
-#endif
+    deactivateProfiler();
+    LINK_WIRELESS_BARRIER;
 
-    if (!isSessionActive())
-      return;
+    profiler = Profiler{};
+    REG_TM[timerId].cnt = 0;
+    REG_TM[timerId + 1].cnt = 0;
+    REG_TM[timerId].start = 0;
+    REG_TM[timerId + 1].start = 0;
+    REG_TM[timerId + 1].cnt = TM_ENABLE | TM_CASCADE;
+    REG_TM[timerId].cnt = TM_ENABLE | TM_FREQ_1;
 
-    if (!asyncCommand.isActive)
-      acceptConnectionsOrTransferData();
+    LINK_WIRELESS_BARRIER;
+    profilerTimerId = timerId;
 
-#ifdef PROFILING_ENABLED
-    lastTimerTime = profileStop();
-    timerIRQCount++;
-#endif
+    return true;
   }
 
-  LINK_WIRELESS_ALWAYS_INLINE void __onACKTimer() {
-    if (!isEnabled || !asyncCommand.isActive ||
-        asyncCommand.ackStep == AsyncCommand::ACKStep::READY)
+  void deactivateProfiler() {
+    if (profilerTimerId == -1)
       return;
 
-    if (asyncCommand.ackStep == AsyncCommand::ACKStep::WAITING_FOR_HIGH) {
-      if (!linkSPI->_isSIHigh())
-        return;
+    u8 timerId = profilerTimerId;
+    profilerTimerId = -1;
+    LINK_WIRELESS_BARRIER;
 
-      linkSPI->_setSOHigh();
-      asyncCommand.ackStep = AsyncCommand::ACKStep::WAITING_FOR_LOW;
-    } else if (asyncCommand.ackStep == AsyncCommand::ACKStep::WAITING_FOR_LOW) {
-      if (linkSPI->_isSIHigh())
-        return;
+    REG_TM[timerId].cnt = 0;
+    REG_TM[timerId + 1].cnt = 0;
+  }
 
-#ifdef PROFILING_ENABLED
-      profileStart();
-#endif
+  void resetProfiler() {
+    s8 timerId = profilerTimerId;
+    profilerTimerId = -1;
+    LINK_WIRELESS_BARRIER;
+
+    profiler = Profiler{};
+
+    LINK_WIRELESS_BARRIER;
+    profilerTimerId = timerId;
+  }
 
-      linkSPI->_setSOLow();
-      asyncCommand.ackStep = AsyncCommand::ACKStep::READY;
-      stopACKTimer();
+  bool isProfilerActive() { return profilerTimerId > -1; }
 
-      if (asyncCommand.state == AsyncCommand::State::PENDING) {
-        updateAsyncCommand(asyncCommand.pendingData);
+  u32 toMs(u32 cycles) {
+    // CPU Frequency * time per frame = cycles per frame
+    // 16780000 * (1/60) ~= 279666
+    return (cycles * 1000) / (279666 * 60);
+  }
 
-        if (asyncCommand.state == AsyncCommand::State::COMPLETED)
-          processAsyncCommand();
-      }
+  Profiler profiler;
 
-#ifdef PROFILING_ENABLED
-      lastACKTimerTime = profileStop();
-      ackTimerIRQCount++;
-#endif
-    }
+  struct MemoryReport {
+    u32 total;
+    u32 queues;
+    u32 sessionState;
+    u32 commandBuffers;
+    u32 serverCache;
+    u32 profiler;
+  };
+
+  static constexpr MemoryReport getMemoryReport() {
+    return MemoryReport{
+        sizeof(LinkWireless),
+        sizeof(IncomingQueue) + sizeof(ReceivedQueue) +
+            sizeof(OutgoingQueue) * 2 + sizeof(ForwardedQueue),
+        sizeof(SessionState),
+        sizeof(AsyncCommand) + sizeof(nextCommandData),
+        sizeof(serverCache),
+        sizeof(Profiler)};
   }
 
   struct Config {
@@ -732,18 +961,24 @@ class LinkWireless {
     u32 interval;
     u32 sendTimerId;
     s8 asyncACKTimerId;
+    bool resume = false;
+    bool sendAndWait = false;  // (all consoles)
+    TransferStrategy strategy = CHAINED;
+    bool clockSync = false;
+    bool signalMonitor = false;
   };
 
   Config config;
 
  private:
+  template <u32 Size>
   class MessageQueue {
    public:
     void push(Message item) {
       if (isFull())
         return;
 
-      rear = (rear + 1) % LINK_WIRELESS_QUEUE_SIZE;
+      rear = (rear + 1) % Size;
       arr[rear] = item;
       count++;
     }
@@ -753,7 +988,7 @@ class LinkWireless {
         return Message{};
 
       auto x = arr[front];
-      front = (front + 1) % LINK_WIRELESS_QUEUE_SIZE;
+      front = (front + 1) % Size;
       count--;
 
       return x;
@@ -772,8 +1007,20 @@ class LinkWireless {
       for (u32 i = 0; i < count; i++) {
         if (!action(arr[currentFront]))
           return;
-        currentFront = (currentFront + 1) % LINK_WIRELESS_QUEUE_SIZE;
+        currentFront = (currentFront + 1) % Size;
+      }
+    }
+
+    template <typename F>
+    bool consume(F action) {
+      while (!isEmpty()) {
+        if (!action(arr[front]))
+          return false;
+        front = (front + 1) % Size;
+        count--;
       }
+
+      return true;
     }
 
     void clear() {
@@ -783,52 +1030,251 @@ class LinkWireless {
 
     int size() { return count; }
     bool isEmpty() { return size() == 0; }
-    bool isFull() { return size() == LINK_WIRELESS_QUEUE_SIZE; }
+    bool isFull() { return size() == Size; }
 
    private:
-    Message arr[LINK_WIRELESS_QUEUE_SIZE];
+    Message arr[Size];
     vs32 front = 0;
     vs32 rear = -1;
     vu32 count = 0;
   };
 
-  struct SessionState {
-    MessageQueue incomingMessages;      // read by user, write by irq&user
-    MessageQueue outgoingMessages;      // read and write by irq
-    MessageQueue tmpMessagesToReceive;  // read and write by irq
-    MessageQueue tmpMessagesToSend;     // read by irq, write by user&irq
-    u32 timeouts[LINK_WIRELESS_MAX_PLAYERS];
-    u32 recvTimeout = 0;
-    u32 frameRecvCount = 0;
-    bool acceptCalled = false;
-    bool pingSent = false;
-#ifdef LINK_WIRELESS_USE_SEND_RECEIVE_LATCH
-    bool sendReceiveLatch = false;
-    bool shouldWaitForServer = false;
-#endif
+  template <u32 Size>
+  class PlayerMessageQueue {
+    // all players share the same slots, but each one has its own list (in
+    // arrival order), so their messages can be read separately in O(1)
+    static_assert(Size < LINK_WIRELESS_NO_SLOT);
 
-    u8 playerCount = 1;
-    u8 currentPlayerId = 0;
+   public:
+    PlayerMessageQueue() { clear(); }
 
-    bool didReceiveLastPacketIdFromServer = false;
-    u32 lastPacketId = 0;
-    u32 lastPacketIdFromServer = 0;
-    u32 lastConfirmationFromServer = 0;
-    u32 lastPacketIdFromClients[LINK_WIRELESS_MAX_PLAYERS];
-    u32 lastConfirmationFromClients[LINK_WIRELESS_MAX_PLAYERS];
-  };
+    void push(Message item, u32 maxMessagesPerPlayer) {
+      u8 playerId = item.playerId;
+      if (isFull() || playerId >= LINK_WIRELESS_MAX_PLAYERS ||
+          counts[playerId] >= maxMessagesPerPlayer)
+        return;
 
-  struct MessageHeader {
-    unsigned int partialPacketId : LINK_WIRELESS_PACKET_ID_BITS;
-    unsigned int isConfirmation : 1;
-    unsigned int playerId : 3;
-    unsigned int clientCount : 2;
-    unsigned int dataChecksum : 4;
-  };
+      u8 slot = freeSlot;
+      freeSlot = next[slot];
+      arr[slot] = item;
+      order[slot] = nextOrder++;
+      next[slot] = LINK_WIRELESS_NO_SLOT;
 
-  union MessageHeaderSerializer {
-    MessageHeader asStruct;
-    u16 asInt;
+      if (heads[playerId] == LINK_WIRELESS_NO_SLOT)
+        heads[playerId] = slot;
+      else
+        next[tails[playerId]] = slot;
+      tails[playerId] = slot;
+      counts[playerId]++;
+      count++;
+    }
+
+    Message pop(u8 playerId) {
+      if (isEmpty(playerId))
+        return Message{};
+
+      u8 slot = heads[playerId];
+      auto x = arr[slot];
+      heads[playerId] = next[slot];
+      next[slot] = freeSlot;
+      freeSlot = slot;
+      counts[playerId]--;
+      count--;
+
+      return x;
+    }
+
+    Message peek(u8 playerId) {
+      if (isEmpty(playerId))
+        return Message{};
+      return arr[heads[playerId]];
+    }
+
+    template <typename F>
+    bool consume(F action) {
+      // (the oldest message is always at the front of its player's list)
+      while (!isEmpty()) {
+        u8 playerId = getOldestPlayerId();
+        if (!action(arr[heads[playerId]]))
+          return false;
+        pop(playerId);
+      }
+
+      return true;
+    }
+
+    void clear() {
+      for (u32 i = 0; i < Size; i++)
+        next[i] = i < Size - 1 ? i + 1 : LINK_WIRELESS_NO_SLOT;
+      for (u32 i = 0; i < LINK_WIRELESS_MAX_PLAYERS; i++) {
+        heads[i] = LINK_WIRELESS_NO_SLOT;
+        counts[i] = 0;
+      }
+      freeSlot = 0;
+      count = 0;
+    }
+
+    int size() { return count; }
+    bool isEmpty() { return size() == 0; }
+    bool isEmpty(u8 playerId) {
+      return heads[playerId] == LINK_WIRELESS_NO_SLOT;
+    }
+    bool isFull() { return size() == Size; }
+
+   private:
+    Message arr[Size];
+    u8 next[Size];
+    u32 order[Size];
+    volatile u8 heads[LINK_WIRELESS_MAX_PLAYERS];
+    u8 tails[LINK_WIRELESS_MAX_PLAYERS];
+    u8 counts[LINK_WIRELESS_MAX_PLAYERS];
+    u8 freeSlot = 0;
+    u32 nextOrder = 0;
+    vu32 count = 0;
+
+    u8 getOldestPlayerId() {
+      u8 oldestPlayerId = 0;
+      u32 maxAge = 0;
+
+      for (u32 i = 0; i < LINK_WIRELESS_MAX_PLAYERS; i++) {
+        if (isEmpty(i))
+          continue;
+
+        u32 age = nextOrder - order[heads[i]];
+        if (age > maxAge) {
+          maxAge = age;
+          oldestPlayerId = i;
+        }
+      }
+
+      return oldestPlayerId;
+    }
+  };
+
+  using IncomingQueue = PlayerMessageQueue<LINK_WIRELESS_INCOMING_QUEUE_SIZE>;
+  using ReceivedQueue = MessageQueue<LINK_WIRELESS_INCOMING_QUEUE_SIZE>;
+  using OutgoingQueue = MessageQueue<LINK_WIRELESS_OUTGOING_QUEUE_SIZE>;
+  using ForwardedQueue = MessageQueue<LINK_WIRELESS_FORWARDED_QUEUE_SIZE>;
+
+  class CommandQueue {
+   public:
+    void push(u8 type) {
+      if (isFull())
+        return;
+
+      rear = (rear + 1) % LINK_WIRELESS_MAX_QUEUED_COMMANDS;
+      arr[rear] = type;
+      count++;
+    }
+
+    u8 pop() {
+      auto x = arr[front];
+      front = (front + 1) % LINK_WIRELESS_MAX_QUEUED_COMMANDS;
+      count--;
+
+      return x;
+    }
+
+    bool contains(u8 type) {
+      int currentFront = front;
+
+      for (u32 i = 0; i < count; i++) {
+        if (arr[currentFront] == type)
+          return true;
+        currentFront = (currentFront + 1) % LINK_WIRELESS_MAX_QUEUED_COMMANDS;
+      }
+
+      return false;
+    }
+
+    void clear() {
+      front = count = 0;
+      rear = -1;
+    }
+
+    bool isEmpty() { return count == 0; }
+    bool isFull() { return count == LINK_WIRELESS_MAX_QUEUED_COMMANDS; }
+
+   private:
+    u8 arr[LINK_WIRELESS_MAX_QUEUED_COMMANDS];
+    vs32 front = 0;
+    vs32 rear = -1;
+    vu32 count = 0;
+  };
+
+  struct SessionState {
+    IncomingQueue incomingMessages;      // read by user, write by irq&user
+    OutgoingQueue outgoingMessages;      // read and write by irq
+    ReceivedQueue tmpMessagesToReceive;  // read and write by irq
+    OutgoingQueue tmpMessagesToSend;     // read by irq, write by user&irq
+    ForwardedQueue forwardedMessages;    // read and write by irq
+    u32 timeouts[LINK_WIRELESS_MAX_PLAYERS];
+    u32 recvTimeout = 0;
+    u32 frameRecvCount = 0;
+    bool acceptCalled = false;
+    bool pingSent = false;
+    bool shouldSampleSignal = false;
+    bool isDataAvailable = false;
+    bool hasNewConfirmations = false;
+    u32 lastSendFrame = 0;
+    bool isChaining = true;
+    bool sendReceiveLatch = false;
+    bool shouldWaitForServer = false;
+
+    u8 playerCount = 1;
+    u8 currentPlayerId = 0;
+
+    bool didReceiveLastPacketIdFromServer = false;
+    bool shouldResyncPacketIds = false;  // (clients only, after a resume)
+    u32 lastPacketId = 0;
+    u32 lastPacketIdFromServer = 0;
+    u32 lastConfirmationFromServer = 0;
+    u32 lastPacketIdFromClients[LINK_WIRELESS_MAX_PLAYERS];
+    u32 lastConfirmationFromClients[LINK_WIRELESS_MAX_PLAYERS];
+    u32 retransmissionTurn = 0;
+    u8 signalLevels[LINK_WIRELESS_MAX_PLAYERS];
+  };
+
+  struct ClockSyncState {
+    ClockSync sync;
+    s32 lastSample = 0;
+    u32 lastSampleTime = 0;
+    u32 lastRequestFrame = 0;
+    u32 requestTime = 0;
+    bool isWaitingResponse = false;
+    u32 responseHighPart = 0;
+    bool hasResponseHighPart = false;
+    bool hasRequest[LINK_WIRELESS_MAX_PLAYERS];
+    u32 requestReceiveTime[LINK_WIRELESS_MAX_PLAYERS];
+  };
+
+  struct MessageRun {
+    u32 headerIndex = 0;
+    u32 size = 0;
+    u8 originId = 0;
+    u8 targetId = 0;
+    u32 firstPacketId = 0;
+    u32 lastPacketId = 0;
+    u32 checksum = 0;
+  };
+
+  struct OutgoingWindow {
+    u32 cursor;    // (last packet id confirmed by the clients of this window)
+    u32 capacity;  // (pending messages up to the next window)
+    u32 size;      // (messages to send in the next transfer)
+  };
+
+  struct MessageHeader {
+    unsigned int partialPacketId : LINK_WIRELESS_PACKET_ID_BITS;
+    unsigned int isConfirmation : 1;
+    unsigned int playerId : 3;
+    unsigned int clientCount : 2;
+    unsigned int dataChecksum : 4;
+  };
+
+  union MessageHeaderSerializer {
+    MessageHeader asStruct;
+    u16 asInt;
   };
 
   struct LoginMemory {
@@ -849,57 +1295,248 @@ class LinkWireless {
       COMMAND_HEADER,
       COMMAND_PARAMETERS,
       RESPONSE_REQUEST,
-      DATA_REQUEST
+      DATA_REQUEST,
+      // (inverted clock)
+      REMOTE_COMMAND,
+      REMOTE_PARAMETERS,
+      REMOTE_ACK
     };
 
-    enum ACKStep { READY, WAITING_FOR_HIGH, WAITING_FOR_LOW };
-
     u8 type;
     u32 parameters[LINK_WIRELESS_MAX_COMMAND_TRANSFER_LENGTH];
-    u32 responses[LINK_WIRELESS_MAX_COMMAND_RESPONSE_LENGTH];
     CommandResult result;
     State state;
     Step step;
     u32 sentParameters, totalParameters;
     u32 receivedResponses, totalResponses;
     u32 pendingData;
-    ACKStep ackStep;
+    u8 remoteCommandId;
+    u32 startTime;
+    u32 retries;
+    u32 retryTicks;
     bool isActive;
   };
 
+  struct StartupState {
+    enum Step {
+      PINGING,
+      LOGGING_IN,
+      HELLO,
+      SETUP,
+      // (resume only)
+      BROADCAST,
+      START_HOST,
+      ACCEPT,
+      CONNECT,
+      CHECK_CONNECTION,
+      FINISH_CONNECTION,
+      SEARCH_START,
+      SEARCH_POLL,
+      SEARCH_END
+    };
+
+    Step step;
+    u32 pendingTicks;
+    u32 loginStep;
+    LoginMemory loginMemory;
+    bool isTransferring;
+    u32 startFrame;
+  };
+
   SessionState sessionState;
   AsyncCommand asyncCommand;
-  LinkSPI* linkSPI = new LinkSPI();
-  LinkGPIO* linkGPIO = new LinkGPIO();
+  CommandQueue pendingAsyncCommands;
+  struct ResumeState {
+    bool isServer;
+    bool shouldSearch;
+    u8 playerCount;
+    u8 acceptedPlayerCount;
+    u8 assignedPlayerId;
+    u16 serverId;
+    Server server;
+    u8 nonce;
+    u32 broadcastData[LINK_WIRELESS_BROADCAST_LENGTH];
+    u32 connectPolls;
+    u32 startFrame;
+  };
+
+  StartupState startup;
+  ResumeState resume;
+  volatile s8 profilerTimerId = -1;
+  LinkSPI32 linkSPI;
+  LinkGPIO linkGPIO;
   State state = NEEDS_RESET;
   u32 nextCommandData[LINK_WIRELESS_MAX_COMMAND_TRANSFER_LENGTH];
   u32 nextCommandDataSize = 0;
+  ClockSyncState clock;
+  OutgoingWindow outgoingWindows[LINK_WIRELESS_MAX_PLAYERS - 1];
+  u32 outgoingWindowCount = 0;
   volatile bool isReadingMessages = false;
   volatile bool isAddingMessage = false;
   volatile bool isPendingClearActive = false;
   Error lastError = NONE;
+  vu32 frameCount = 0;
+  u32 startupFrames = 0;
+  Server serverCache[LINK_WIRELESS_MAX_SERVERS];
+  u32 lastServerPollFrame = 0;
   volatile bool isEnabled = false;
 
-  void forwardMessageIfNeeded(Message& message) {
-    if (state == SERVING && config.forwarding && sessionState.playerCount > 2)
-      send(message.data, message.playerId);
+  LINK_WIRELESS_ALWAYS_INLINE void handleVBlank() {
+    if (state == STARTING &&
+        frameCount - startup.startFrame > LINK_WIRELESS_START_TIMEOUT_FRAMES) {
+      resetAsync(TIMEOUT);
+      return;
+    }
+
+    if (state == RESUMING &&
+        frameCount - resume.startFrame > LINK_WIRELESS_RESUME_TIMEOUT_FRAMES) {
+      if (startup.step == StartupState::Step::ACCEPT &&
+          resume.acceptedPlayerCount > 1) {
+        // (some clients didn't come back, continue without them)
+        sessionState.playerCount = resume.acceptedPlayerCount;
+        finishResume(SERVING);
+      } else
+        resetAsync(TIMEOUT);
+      return;
+    }
+
+    if (!isSessionActive())
+      return;
+
+    if (isConnected() && sessionState.frameRecvCount == 0)
+      sessionState.recvTimeout++;
+
+    if (sessionState.recvTimeout >= config.timeout) {
+      resetAsync(TIMEOUT);
+      return;
+    }
+
+    if (!checkRemoteTimeouts()) {
+      resetAsync(REMOTE_TIMEOUT);
+      return;
+    }
+
+    sessionState.frameRecvCount = 0;
+    sessionState.acceptCalled = false;
+    sessionState.pingSent = false;
+
+    if (config.signalMonitor &&
+        frameCount % LINK_WIRELESS_SIGNAL_LEVEL_INTERVAL_FRAMES == 0)
+      sessionState.shouldSampleSignal = true;
+  }
+
+  LINK_WIRELESS_ALWAYS_INLINE void handleSerial() {
+    bool isLoggingIn = isStartingAdapter() &&
+                       startup.step == StartupState::Step::LOGGING_IN;
+    linkSPI._onSerial(!isLoggingIn);
+
+    bool hasNewData = linkSPI.getAsyncState() == LinkSPI::AsyncState::READY;
+    if (isLoggingIn) {
+      if (hasNewData)
+        processLoginResponse(linkSPI.getAsyncData());
+      return;
+    }
+    if (!hasNewData)
+      return;
+
+    u32 newData = linkSPI.getAsyncData();
+    if (isWaitingForAdapter()) {
+      processAdapterTransfer(newData);
+      return;
+    }
+
+    startHandshake(LinkSPI::HandshakeType::ACKNOWLEDGE, newData);
+  }
+
+  LINK_WIRELESS_ALWAYS_INLINE void handleTimer() {
+    if (isStartingAdapter()) {
+      continueStart();
+      return;
+    }
+
+    if (!isSessionActive())
+      return;
+
+    if (asyncCommand.isActive && asyncCommand.retryTicks > 0) {
+      if (--asyncCommand.retryTicks == 0)
+        startAsyncCommand();
+      return;
+    }
+    if (asyncCommand.isActive &&
+        asyncCommand.type == LINK_WIRELESS_COMMAND_SEND_DATA_AND_WAIT)
+      return;
+
+    acceptConnectionsOrTransferData();
+  }
+
+  LINK_WIRELESS_ALWAYS_INLINE void handleACKTimer() {
+    if (linkSPI._onHandshakeTimer())
+      finishHandshake();
+  }
+
+  void startHandshake(LinkSPI::HandshakeType type,
+                      u32 newData) {  // (irq only)
+    // (without `asyncACKTimerId`, this finishes synchronously)
+    asyncCommand.pendingData = newData;
+    if (linkSPI.startHandshakeAsync(type, config.asyncACKTimerId,
+                                    LINK_WIRELESS_CMD_TIMEOUT) !=
+        LinkSPI::HandshakeState::HANDSHAKE_WAITING)
+      finishHandshake();
+  }
+
+  void finishHandshake() {  // (irq only)
+    bool success = linkSPI.getHandshakeState() ==
+                   LinkSPI::HandshakeState::HANDSHAKE_DONE;
+    u32 newData = asyncCommand.pendingData;
+
+    if (isWaitingForAdapter()) {
+      continueAdapterTransfer(newData, success);
+      return;
+    }
+
+    if (!success) {
+      if (!retryAsyncCommand())
+        resetAsync(ACKNOWLEDGE_FAILED);
+      return;
+    }
+
+    if (!isSessionActive() && !isStartingAdapter())
+      return;
+
+    if (asyncCommand.isActive &&
+        asyncCommand.state == AsyncCommand::State::PENDING) {
+      updateAsyncCommand(newData);
+
+      if (asyncCommand.state == AsyncCommand::State::COMPLETED)
+        processAsyncCommand();
+    }
   }
 
   void processAsyncCommand() {  // (irq only)
+    profileAsyncCommand();
+
     if (!asyncCommand.result.success) {
-      if (asyncCommand.type == LINK_WIRELESS_COMMAND_SEND_DATA)
-        lastError = SEND_DATA_FAILED;
+      if (retryAsyncCommand())
+        return;
+
+      if (asyncCommand.type == LINK_WIRELESS_COMMAND_SEND_DATA ||
+          asyncCommand.type == LINK_WIRELESS_COMMAND_SEND_DATA_AND_WAIT)
+        resetAsync(SEND_DATA_FAILED);
       else if (asyncCommand.type == LINK_WIRELESS_COMMAND_RECEIVE_DATA)
-        lastError = RECEIVE_DATA_FAILED;
+        resetAsync(RECEIVE_DATA_FAILED);
       else
-        lastError = COMMAND_FAILED;
+        resetAsync(COMMAND_FAILED);
 
-      reset();
       return;
     }
 
     asyncCommand.isActive = false;
 
+    if (isStartingAdapter()) {
+      processStartupCommand();
+      return;
+    }
+
     switch (asyncCommand.type) {
       case LINK_WIRELESS_COMMAND_ACCEPT_CONNECTIONS: {
         // AcceptConnections (end)
@@ -908,30 +1545,62 @@ class LinkWireless {
 
         break;
       }
+      case LINK_WIRELESS_COMMAND_SIGNAL_LEVEL: {
+        // SignalLevel (end)
+        if (asyncCommand.result.responsesSize == 0)
+          break;
+
+        // (one byte per client; clients only get their own)
+        u32 levels = asyncCommand.result.responses[0];
+        for (u32 i = 1; i < LINK_WIRELESS_MAX_PLAYERS; i++)
+          sessionState.signalLevels[i] = (levels >> ((i - 1) * 8)) & 0xff;
+
+        break;
+      }
       case LINK_WIRELESS_COMMAND_SEND_DATA: {
         // SendData (end)
 
-#ifdef LINK_WIRELESS_USE_SEND_RECEIVE_LATCH
-        if (state == CONNECTED)
-          sessionState.shouldWaitForServer = true;
-        sessionState.sendReceiveLatch = !sessionState.sendReceiveLatch;
-#endif
-#ifndef LINK_WIRELESS_USE_SEND_RECEIVE_LATCH
-        if (state == SERVING) {
+        if (!sessionState.isChaining) {
+          if (state == CONNECTED)
+            sessionState.shouldWaitForServer = true;
+          sessionState.sendReceiveLatch = !sessionState.sendReceiveLatch;
+        } else if (state == SERVING) {
           // ReceiveData (start)
           sendCommandAsync(LINK_WIRELESS_COMMAND_RECEIVE_DATA);
         }
-#endif
+
+        break;
+      }
+      case LINK_WIRELESS_COMMAND_SEND_DATA_AND_WAIT: {
+        // SendDataAndWait (end)
+
+        if (asyncCommand.remoteCommandId == LINK_WIRELESS_EVENT_DISCONNECTED) {
+          resetAsync(DISCONNECTED);
+          return;
+        }
+        if (asyncCommand.remoteCommandId ==
+            LINK_WIRELESS_EVENT_DATA_AVAILABLE) {
+          // (the server is alive, even if its data is read on the next tick)
+          sessionState.isDataAvailable = true;
+          sessionState.frameRecvCount++;
+          sessionState.recvTimeout = 0;
+        } else if (asyncCommand.remoteCommandId ==
+                   LINK_WIRELESS_EVENT_WAIT_TIMEOUT) {
+          // (the adapter waited `LINK_WIRELESS_WAIT_TIMEOUT_FRAMES` frames
+          // without hearing from the server)
+          sessionState.recvTimeout += LINK_WIRELESS_WAIT_TIMEOUT_FRAMES;
+        }
 
         break;
       }
       case LINK_WIRELESS_COMMAND_RECEIVE_DATA: {
         // ReceiveData (end)
 
-#ifdef LINK_WIRELESS_USE_SEND_RECEIVE_LATCH
-        sessionState.sendReceiveLatch =
-            sessionState.shouldWaitForServer || !sessionState.sendReceiveLatch;
-#endif
+        sessionState.isDataAvailable = false;
+
+        if (!sessionState.isChaining)
+          sessionState.sendReceiveLatch = sessionState.shouldWaitForServer ||
+                                          !sessionState.sendReceiveLatch;
 
         if (asyncCommand.result.responsesSize == 0)
           break;
@@ -939,56 +1608,293 @@ class LinkWireless {
         sessionState.frameRecvCount++;
         sessionState.recvTimeout = 0;
 
-#ifdef LINK_WIRELESS_USE_SEND_RECEIVE_LATCH
-        sessionState.shouldWaitForServer = false;
-#endif
+        if (!sessionState.isChaining)
+          sessionState.shouldWaitForServer = false;
 
         trackRemoteTimeouts();
         addIncomingMessagesFromData(asyncCommand.result);
 
-#ifndef LINK_WIRELESS_USE_SEND_RECEIVE_LATCH
-        if (state == CONNECTED) {
+        if (state == CONNECTED && config.sendAndWait) {
+          // SendDataAndWait (start)
+          sendPendingData(LINK_WIRELESS_COMMAND_SEND_DATA_AND_WAIT);
+          break;
+        }
+
+        if (sessionState.isChaining && state == CONNECTED) {
           // SendData (start)
           sendPendingData();
         }
-#endif
 
         break;
       }
       default: {
       }
     }
+
+    if (!asyncCommand.isActive && !pendingAsyncCommands.isEmpty()) {
+      // (next queued command)
+      u8 type = pendingAsyncCommands.pop();
+      if (isSessionActive())
+        runAsyncCommand(type);
+    }
+  }
+
+  void processStartupCommand() {  // (irq only)
+    auto& result = asyncCommand.result;
+
+    switch (asyncCommand.type) {
+      case LINK_WIRELESS_COMMAND_HELLO: {
+        // Hello (end)
+        startup.step = StartupState::Step::SETUP;
+
+        // Setup (start)
+        addSetupData(state == RESUMING && resume.isServer
+                         ? config.maxPlayers
+                         : LINK_WIRELESS_MAX_PLAYERS);
+        sendCommandAsync(LINK_WIRELESS_COMMAND_SETUP, true);
+
+        break;
+      }
+      case LINK_WIRELESS_COMMAND_SETUP: {
+        // Setup (end)
+        finishStart();
+
+        break;
+      }
+      case LINK_WIRELESS_COMMAND_BROADCAST: {
+        // Broadcast (end) -> StartHost (start)
+        startup.step = StartupState::Step::START_HOST;
+        sendCommandAsync(LINK_WIRELESS_COMMAND_START_HOST);
+
+        break;
+      }
+      case LINK_WIRELESS_COMMAND_START_HOST: {
+        // StartHost (end)
+        startup.step = StartupState::Step::ACCEPT;
+        startup.pendingTicks = 0;
+
+        break;
+      }
+      case LINK_WIRELESS_COMMAND_ACCEPT_CONNECTIONS: {
+        // AcceptConnections (end)
+        resume.acceptedPlayerCount =
+            min(1 + result.responsesSize, config.maxPlayers);
+
+        if (resume.acceptedPlayerCount >= resume.playerCount) {
+          sessionState.playerCount = resume.acceptedPlayerCount;
+          finishResume(SERVING);
+        } else
+          startup.pendingTicks = linesToTicks(LINK_WIRELESS_LINES_PER_FRAME);
+
+        break;
+      }
+      case LINK_WIRELESS_COMMAND_CONNECT: {
+        // Connect (end)
+        startup.step = StartupState::Step::CHECK_CONNECTION;
+        startup.pendingTicks = linesToTicks(LINK_WIRELESS_LINES_PER_FRAME);
+        resume.connectPolls = 0;
+
+        break;
+      }
+      case LINK_WIRELESS_COMMAND_IS_FINISHED_CONNECT: {
+        // IsFinishedConnect (end)
+        if (result.responsesSize == 0) {
+          resetAsync(COMMAND_FAILED);
+          return;
+        }
+
+        u8 assignedPlayerId = 1 + (u8)msB32(result.responses[0]);
+        bool isConnecting =
+            result.responses[0] == LINK_WIRELESS_STILL_CONNECTING;
+
+        if (isConnecting &&
+            ++resume.connectPolls <= LINK_WIRELESS_RESUME_CONNECT_POLLS) {
+          startup.pendingTicks = linesToTicks(LINK_WIRELESS_LINES_PER_FRAME);
+        } else if (isConnecting ||
+                   assignedPlayerId >= LINK_WIRELESS_MAX_PLAYERS) {
+          // (the server id changed, look for the same room again)
+          if (resume.server.id == LINK_WIRELESS_END || resume.shouldSearch) {
+            resetAsync(CONNECTION_FAILED);
+            return;
+          }
+
+          resume.shouldSearch = true;
+          stop();
+          startAsync(true);
+        } else {
+          // FinishConnection (start)
+          resume.assignedPlayerId = assignedPlayerId;
+          startup.step = StartupState::Step::FINISH_CONNECTION;
+          sendCommandAsync(LINK_WIRELESS_COMMAND_FINISH_CONNECTION);
+        }
+
+        break;
+      }
+      case LINK_WIRELESS_COMMAND_FINISH_CONNECTION: {
+        // FinishConnection (end)
+        if (resume.assignedPlayerId != sessionState.currentPlayerId)
+          changeCurrentPlayerId(resume.assignedPlayerId);
+        finishResume(CONNECTED);
+
+        break;
+      }
+      case LINK_WIRELESS_COMMAND_BROADCAST_READ_START: {
+        // BroadcastReadStart (end)
+        startup.step = StartupState::Step::SEARCH_POLL;
+        startup.pendingTicks =
+            linesToTicks(LINK_WIRELESS_BROADCAST_POLL_INTERVAL_FRAMES *
+                         LINK_WIRELESS_LINES_PER_FRAME);
+
+        break;
+      }
+      case LINK_WIRELESS_COMMAND_BROADCAST_READ_POLL: {
+        // BroadcastReadPoll (end)
+        Server servers[LINK_WIRELESS_MAX_SERVERS];
+        u32 totalServers = parseServers(result, servers);
+
+        for (u32 i = 0; i < totalServers; i++) {
+          if (isSameRoom(servers[i], resume.server)) {
+            // BroadcastReadEnd (start)
+            resume.serverId = servers[i].id;
+            startup.step = StartupState::Step::SEARCH_END;
+            sendCommandAsync(LINK_WIRELESS_COMMAND_BROADCAST_READ_END);
+            return;
+          }
+        }
+
+        startup.pendingTicks =
+            linesToTicks(LINK_WIRELESS_BROADCAST_POLL_INTERVAL_FRAMES *
+                         LINK_WIRELESS_LINES_PER_FRAME);
+
+        break;
+      }
+      case LINK_WIRELESS_COMMAND_BROADCAST_READ_END: {
+        // BroadcastReadEnd (end) -> Connect (start)
+        connectAsync();
+
+        break;
+      }
+      default: {
+      }
+    }
+  }
+
+  bool retryAsyncCommand() {  // (irq only)
+    if (!isSessionActive() || !asyncCommand.isActive ||
+        asyncCommand.retries >= LINK_WIRELESS_MAX_COMMAND_RETRIES)
+      return false;
+
+    // (restarts the same command after 1, 2, 4, ... timer ticks)
+    asyncCommand.retryTicks = 1 << asyncCommand.retries;
+    asyncCommand.retries++;
+    asyncCommand.state = AsyncCommand::State::COMPLETED;
+
+    return true;
   }
 
   void acceptConnectionsOrTransferData() {  // (irq only)
+    if (sessionState.shouldSampleSignal) {
+      // SignalLevel (start)
+      scheduleAsyncCommand(LINK_WIRELESS_COMMAND_SIGNAL_LEVEL);
+      sessionState.shouldSampleSignal = false;
+    }
+
     if (state == SERVING && !sessionState.acceptCalled &&
         sessionState.playerCount < config.maxPlayers) {
       // AcceptConnections (start)
-      sendCommandAsync(LINK_WIRELESS_COMMAND_ACCEPT_CONNECTIONS);
+      scheduleAsyncCommand(LINK_WIRELESS_COMMAND_ACCEPT_CONNECTIONS);
       sessionState.acceptCalled = true;
-    } else if (state == CONNECTED || isConnected()) {
-#ifdef LINK_WIRELESS_USE_SEND_RECEIVE_LATCH
-      bool shouldReceive =
-          !sessionState.sendReceiveLatch || sessionState.shouldWaitForServer;
-#endif
-#ifndef LINK_WIRELESS_USE_SEND_RECEIVE_LATCH
-      bool shouldReceive = state == CONNECTED;
-#endif
-
-      if (shouldReceive) {
+    } else if (state == CONNECTED && config.sendAndWait) {
+      if (sessionState.isDataAvailable) {
         // ReceiveData (start)
-        sendCommandAsync(LINK_WIRELESS_COMMAND_RECEIVE_DATA);
+        scheduleAsyncCommand(LINK_WIRELESS_COMMAND_RECEIVE_DATA);
       } else {
-        // SendData (start)
-        sendPendingData();
+        // SendDataAndWait (start)
+        scheduleAsyncCommand(LINK_WIRELESS_COMMAND_SEND_DATA_AND_WAIT);
       }
+    } else if (state == CONNECTED || isConnected()) {
+      // SendData or ReceiveData (start)
+      scheduleAsyncCommand(LINK_WIRELESS_COMMAND_TRANSFER);
     }
   }
 
-  void sendPendingData() {  // (irq only)
+  u8 getTransferCommand() {  // (irq only)
+    // (this is decided when the transfer is dispatched, not when it's
+    // scheduled, so messages queued in between don't wait for another tick)
+    sessionState.isChaining = shouldChainTransfers();
+
+    bool shouldReceive =
+        sessionState.isChaining
+            ? state == CONNECTED
+            : !sessionState.sendReceiveLatch ||
+                  sessionState.shouldWaitForServer;
+
+    // (clients in SendDataAndWait mode wake up on every server transfer,
+    // so servers skip the ones that wouldn't tell them anything new)
+    if (!shouldReceive && state == SERVING && config.sendAndWait &&
+        isIdleServerTransfer())
+      shouldReceive = true;
+
+    return shouldReceive ? LINK_WIRELESS_COMMAND_RECEIVE_DATA
+                         : LINK_WIRELESS_COMMAND_SEND_DATA;
+  }
+
+  bool shouldChainTransfers() {  // (irq only)
+    switch (config.strategy) {
+      case CHAINED:
+        return true;
+      case LATCH:
+        return false;
+      default: {
+        // (chain sends and receives only while there are pending messages)
+        return !sessionState.outgoingMessages.isEmpty() ||
+               !sessionState.tmpMessagesToSend.isEmpty() ||
+               !sessionState.forwardedMessages.isEmpty();
+      }
+    }
+  }
+
+  bool isIdleServerTransfer() {  // (irq only)
+    if (!sessionState.outgoingMessages.isEmpty() ||
+        !sessionState.tmpMessagesToSend.isEmpty() ||
+        !sessionState.forwardedMessages.isEmpty() ||
+        sessionState.hasNewConfirmations ||
+        frameCount - sessionState.lastSendFrame >=
+            LINK_WIRELESS_IDLE_KEEPALIVE_FRAMES)
+      return false;
+
+    for (u32 i = 1; i < LINK_WIRELESS_MAX_PLAYERS; i++)
+      if (clock.hasRequest[i])
+        return false;
+
+    return true;
+  }
+
+  void scheduleAsyncCommand(u8 type) {  // (irq only)
+    if (!asyncCommand.isActive)
+      runAsyncCommand(type);
+    else if (!pendingAsyncCommands.contains(type))
+      pendingAsyncCommands.push(type);
+  }
+
+  void runAsyncCommand(u8 type) {  // (irq only)
+    if (type == LINK_WIRELESS_COMMAND_TRANSFER)
+      type = getTransferCommand();
+
+    if (type == LINK_WIRELESS_COMMAND_SEND_DATA ||
+        type == LINK_WIRELESS_COMMAND_SEND_DATA_AND_WAIT)
+      sendPendingData(type);
+    else
+      sendCommandAsync(type);
+  }
+
+  void sendPendingData(
+      u8 type = LINK_WIRELESS_COMMAND_SEND_DATA) {  // (irq only)
     copyOutgoingState();
     int lastPacketId = setDataFromOutgoingMessages();
-    sendCommandAsync(LINK_WIRELESS_COMMAND_SEND_DATA, true);
+    sessionState.hasNewConfirmations = false;
+    sessionState.lastSendFrame = frameCount;
+    sendCommandAsync(type, true);
     clearOutgoingMessagesIfNeeded(lastPacketId);
   }
 
@@ -1002,23 +1908,51 @@ class LinkWireless {
     else
       addPingMessageIfNeeded();
 
+    if (config.clockSync)
+      addClockSyncData(maxTransferLength);
+
+    bool usesWindows = state == SERVING && config.retransmission;
+    if (usesWindows)
+      buildOutgoingWindows(maxTransferLength + 1 - nextCommandDataSize);
+
     int lastPacketId = -1;
+    MessageRun run;
+
+    sessionState.outgoingMessages.forEach([this, maxTransferLength, usesWindows,
+                                           &lastPacketId,
+                                           &run](Message message) {
+      if (usesWindows && !isInOutgoingWindow(message.packetId)) {
+        finishMessageRun(run);
+        return true;
+      }
 
-    sessionState.outgoingMessages.forEach(
-        [this, maxTransferLength, &lastPacketId](Message message) {
-          u16 header = buildMessageHeader(message.playerId, message.packetId,
-                                          buildChecksum(message.data));
-          u32 rawMessage = buildU32(header, message.data);
+      bool isUnicast = message.targetId != LINK_WIRELESS_ALL_PLAYERS;
+      bool isForwarded = message.playerId != sessionState.currentPlayerId;
+      bool fitsRun = nextCommandDataSize < maxTransferLength ||
+                     continuesRun(run, message);
+      if (isUnicast || (isForwarded && fitsRun)) {
+        if (!addRunMessage(run, message, maxTransferLength))
+          return false;
 
-          if (nextCommandDataSize /* -1 (wireless header) + 1 (rawMessage) */ >
-              maxTransferLength)
-            return false;
+        lastPacketId = message.packetId;
+        return true;
+      }
+      finishMessageRun(run);
 
-          addData(rawMessage);
-          lastPacketId = message.packetId;
+      u16 header = buildMessageHeader(message.playerId, message.packetId,
+                                      buildChecksum(message.data));
+      u32 rawMessage = buildU32(header, message.data);
 
-          return true;
-        });
+      if (nextCommandDataSize /* -1 (wireless header) + 1 (rawMessage) */ >
+          maxTransferLength)
+        return false;
+
+      addData(rawMessage);
+      lastPacketId = message.packetId;
+
+      return true;
+    });
+    finishMessageRun(run);
 
     // (add wireless header)
     u32 bytes = (nextCommandDataSize - 1) * 4;
@@ -1029,6 +1963,336 @@ class LinkWireless {
     return lastPacketId;
   }
 
+  bool continuesRun(MessageRun& run, Message& message) {  // (irq only)
+    return run.size > 0 && run.originId == message.playerId &&
+           run.targetId == message.targetId &&
+           message.packetId == run.lastPacketId + 1 &&
+           run.size < LINK_WIRELESS_MESSAGE_RUN_MAX_MESSAGES;
+  }
+
+  bool addRunMessage(MessageRun& run,
+                     Message& message,
+                     u32 maxTransferLength) {  // (irq only)
+    // consecutive messages with the same origin and target share a run
+    // header, and their data is packed in pairs (two messages per word)
+    bool isContinuation = continuesRun(run, message);
+
+    if (isContinuation && run.size % 2 == 1) {
+      nextCommandData[nextCommandDataSize - 1] |= message.data;
+    } else if (isContinuation) {
+      if (nextCommandDataSize > maxTransferLength)
+        return false;
+      addData((u32)message.data << 16);
+    } else {
+      finishMessageRun(run);
+      if (nextCommandDataSize + 1 > maxTransferLength)
+        return false;
+
+      run.headerIndex = nextCommandDataSize;
+      run.originId = message.playerId;
+      run.targetId = message.targetId;
+      run.firstPacketId = message.packetId;
+      run.checksum = 0;
+      addData(0);  // (header, written when the run ends)
+      addData((u32)message.data << 16);
+    }
+
+    run.size++;
+    run.lastPacketId = message.packetId;
+    run.checksum += buildChecksum(message.data);
+    return true;
+  }
+
+  void finishMessageRun(MessageRun& run) {  // (irq only)
+    if (run.size == 0)
+      return;
+
+    bool isRelay = run.targetId == LINK_WIRELESS_ALL_PLAYERS;
+    if (isRelay && run.size == 1) {
+      // (a single forwarded message is cheaper as a regular one)
+      u16 data = msB32(nextCommandData[nextCommandDataSize - 1]);
+      u16 header = buildMessageHeader(run.originId, run.firstPacketId,
+                                      buildChecksum(data));
+      nextCommandDataSize--;
+      nextCommandData[run.headerIndex] = buildU32(header, data);
+      run.size = 0;
+      return;
+    }
+
+    // run headers "repurpose" confirmation headers:
+    //     packetId    => first packet id
+    //     playerId    => MESSAGE_RUN
+    //     clientCount => target client id - 1 (or origin client id - 1)
+    //     data        => message count | data checksum | origin client id
+    // (relays have an origin and go to everyone but their author, while
+    // unicasts come from the server and go to a single client)
+    u8 originId = isRelay ? run.originId : 0;
+    u16 info = run.size |
+               ((run.checksum % 16) << LINK_WIRELESS_MESSAGE_RUN_COUNT_BITS) |
+               (originId << LINK_WIRELESS_MESSAGE_RUN_ORIGIN_BIT);
+
+    MessageHeader header;
+    header.partialPacketId = run.firstPacketId % LINK_WIRELESS_MAX_PACKET_IDS;
+    header.isConfirmation = true;
+    header.playerId = LINK_WIRELESS_MESSAGE_RUN;
+    header.clientCount = (isRelay ? run.originId : run.targetId) - 1;
+    header.dataChecksum = buildChecksum(info);
+
+    MessageHeaderSerializer serializer;
+    serializer.asStruct = header;
+    nextCommandData[run.headerIndex] = buildU32(serializer.asInt, info);
+    run.size = 0;
+  }
+
+  u32 receiveMessageRun(CommandResult& result,
+                        u32 i,
+                        MessageHeader& header,
+                        u16 info) {  // (irq only)
+    u32 size = info & LINK_WIRELESS_MESSAGE_RUN_MAX_MESSAGES;
+    u32 checksum = (info >> LINK_WIRELESS_MESSAGE_RUN_COUNT_BITS) & 0b1111;
+    u8 originId = info >> LINK_WIRELESS_MESSAGE_RUN_ORIGIN_BIT;
+    u32 words = (size + 1) / 2;
+    if (size == 0 || originId >= LINK_WIRELESS_MAX_PLAYERS ||
+        i + words >= result.responsesSize)
+      return result.responsesSize;
+
+    // (skipped clients only advance their packet ids, without reading the data)
+    bool isRelay = originId > 0;
+    bool isForMe = isRelay
+                       ? originId != sessionState.currentPlayerId
+                       : 1 + header.clientCount == sessionState.currentPlayerId;
+    if (isRelay)
+      sessionState.timeouts[originId] = 0;
+    if (isForMe) {
+      u32 dataChecksum = 0;
+      for (u32 j = 0; j < size; j++)
+        dataChecksum += buildChecksum(getRunData(result, i, j));
+      if (dataChecksum % 16 != checksum)
+        return i + words;
+    }
+
+    for (u32 j = 0; j < size; j++) {
+      Message message;
+      message.packetId =
+          (header.partialPacketId + j) % LINK_WIRELESS_MAX_PACKET_IDS;
+      message.data = isForMe ? getRunData(result, i, j) : 0;
+      message.playerId = originId;
+      message.targetId =
+          isRelay ? LINK_WIRELESS_ALL_PLAYERS : sessionState.currentPlayerId;
+
+      if (acceptMessage(message, false, sessionState.playerCount) && isForMe)
+        sessionState.tmpMessagesToReceive.push(message);
+    }
+
+    return i + words;
+  }
+
+  u16 getRunData(CommandResult& result, u32 i, u32 j) {  // (irq only)
+    u32 word = result.responses[i + 1 + j / 2];
+    return j % 2 == 0 ? msB32(word) : lsB32(word);
+  }
+
+  void buildOutgoingWindows(u32 slots) {  // (irq only)
+    // the server's messages reach all clients, but each client only accepts
+    // the packet id that follows its last confirmation, so clients that lost
+    // messages need older ones than the rest: one window per distinct client
+    // confirmation, sharing the transfer's slots fairly between them
+    outgoingWindowCount = 0;
+    if (sessionState.outgoingMessages.isEmpty())
+      return;
+
+    u32 firstPacketId = sessionState.outgoingMessages.peek().packetId;
+    u32 lastPacketId = sessionState.lastPacketId;
+
+    for (u32 i = 1; i < sessionState.playerCount; i++) {
+      u32 confirmation = sessionState.lastConfirmationFromClients[i];
+      if (confirmation == 0)
+        continue;
+      addOutgoingWindow(max(confirmation, firstPacketId - 1));
+    }
+    if (outgoingWindowCount == 0)
+      addOutgoingWindow(firstPacketId - 1);
+
+    for (u32 i = 0; i < outgoingWindowCount; i++) {
+      u32 nextCursor = i < outgoingWindowCount - 1
+                           ? outgoingWindows[i + 1].cursor
+                           : max(lastPacketId, outgoingWindows[i].cursor);
+      outgoingWindows[i].capacity = nextCursor - outgoingWindows[i].cursor;
+      outgoingWindows[i].size = 0;
+    }
+
+    // (windows with less pending messages than their share are served fully,
+    // then the rest split the remaining slots)
+    bool isServed[LINK_WIRELESS_MAX_PLAYERS - 1] = {};
+    u32 pendingWindows = outgoingWindowCount;
+    bool changed = true;
+    while (changed && pendingWindows > 0) {
+      changed = false;
+      u32 share = slots / pendingWindows;
+      for (u32 i = 0; i < outgoingWindowCount; i++) {
+        auto& window = outgoingWindows[i];
+        if (!isServed[i] && window.capacity <= share) {
+          window.size = window.capacity;
+          slots -= window.size;
+          isServed[i] = true;
+          pendingWindows--;
+          changed = true;
+        }
+      }
+    }
+    if (pendingWindows == 0)
+      return;
+
+    // (the extra slots rotate between windows on each transfer)
+    u32 share = slots / pendingWindows;
+    u32 extraSlots = slots % pendingWindows;
+    u32 turn = sessionState.retransmissionTurn++ % pendingWindows;
+    u32 pendingIndex = 0;
+    for (u32 i = 0; i < outgoingWindowCount; i++) {
+      auto& window = outgoingWindows[i];
+      if (isServed[i])
+        continue;
+
+      u32 offset = (pendingIndex + pendingWindows - turn) % pendingWindows;
+      window.size = share + (offset < extraSlots ? 1 : 0);
+      pendingIndex++;
+    }
+  }
+
+  void addOutgoingWindow(u32 cursor) {  // (irq only)
+    // (windows are sorted by cursor and never repeated)
+    u32 i = 0;
+    while (i < outgoingWindowCount && outgoingWindows[i].cursor < cursor)
+      i++;
+    if (i < outgoingWindowCount && outgoingWindows[i].cursor == cursor)
+      return;
+
+    for (u32 j = outgoingWindowCount; j > i; j--)
+      outgoingWindows[j] = outgoingWindows[j - 1];
+    outgoingWindows[i].cursor = cursor;
+    outgoingWindowCount++;
+  }
+
+  bool isInOutgoingWindow(u32 packetId) {  // (irq only)
+    for (u32 i = 0; i < outgoingWindowCount; i++) {
+      auto& window = outgoingWindows[i];
+      if (packetId > window.cursor && packetId <= window.cursor + window.size)
+        return true;
+    }
+
+    return false;
+  }
+
+  void addClockSyncData(u32 maxTransferLength) {  // (irq only)
+    // clock sync words "repurpose" confirmation headers:
+    //     playerId    => REQUEST (client) or RESPONSE (server)
+    //     clientCount => client id - 1
+    // clients ask for the server's time every second, and the server answers
+    // with the middle point between the request's arrival and the response
+    if (state == CONNECTED) {
+      bool isFirstRequest =
+          clock.sync.samples == 0 && !clock.isWaitingResponse;
+      if (nextCommandDataSize > maxTransferLength ||
+          (!isFirstRequest && frameCount - clock.lastRequestFrame <
+                                  LINK_WIRELESS_CLOCK_SYNC_INTERVAL_FRAMES))
+        return;
+
+      addData(buildClockSyncData(LINK_WIRELESS_CLOCK_SYNC_REQUEST,
+                                 sessionState.currentPlayerId, 0));
+      clock.requestTime = getLocalTime();
+      clock.lastRequestFrame = frameCount;
+      clock.isWaitingResponse = true;
+      clock.hasResponseHighPart = false;
+    } else {
+      for (u32 i = 1; i < LINK_WIRELESS_MAX_PLAYERS; i++) {
+        if (!clock.hasRequest[i] || nextCommandDataSize + 1 > maxTransferLength)
+          continue;
+
+        u32 receiveTime = clock.requestReceiveTime[i];
+        u32 time = receiveTime + (getLocalTime() - receiveTime) / 2;
+        addData(buildClockSyncData(
+            LINK_WIRELESS_CLOCK_SYNC_RESPONSE, i,
+            (1 << LINK_WIRELESS_CLOCK_SYNC_HIGH_PART_BIT) |
+                (time >> LINK_WIRELESS_CLOCK_SYNC_LOW_BITS)));
+        addData(buildClockSyncData(
+            LINK_WIRELESS_CLOCK_SYNC_RESPONSE, i,
+            time & ((1 << LINK_WIRELESS_CLOCK_SYNC_LOW_BITS) - 1)));
+        clock.hasRequest[i] = false;
+      }
+    }
+  }
+
+  void handleClockSyncData(u8 type,
+                           u8 clientIndex,
+                           u32 payload) {  // (irq only)
+    u8 clientId = 1 + clientIndex;
+
+    if (state == SERVING && type == LINK_WIRELESS_CLOCK_SYNC_REQUEST) {
+      if (clientId >= sessionState.playerCount)
+        return;
+
+      clock.hasRequest[clientId] = true;
+      clock.requestReceiveTime[clientId] = getLocalTime();
+    } else if (state == CONNECTED && type == LINK_WIRELESS_CLOCK_SYNC_RESPONSE &&
+               clientId == sessionState.currentPlayerId &&
+               clock.isWaitingResponse) {
+      u32 value = payload & ((1 << LINK_WIRELESS_CLOCK_SYNC_LOW_BITS) - 1);
+
+      if ((payload >> LINK_WIRELESS_CLOCK_SYNC_HIGH_PART_BIT) & 1) {
+        clock.responseHighPart = value;
+        clock.hasResponseHighPart = true;
+        return;
+      }
+      if (!clock.hasResponseHighPart)
+        return;
+
+      u32 serverTime =
+          (clock.responseHighPart << LINK_WIRELESS_CLOCK_SYNC_LOW_BITS) | value;
+      u32 responseTime = getLocalTime();
+      u32 delay = responseTime - clock.requestTime;
+      u32 localTime = clock.requestTime + delay / 2;
+
+      clock.isWaitingResponse = false;
+      clock.hasResponseHighPart = false;
+      if (delay <= LINK_WIRELESS_CLOCK_SYNC_MAX_DELAY_LINES)
+        addClockSample((s32)(serverTime - localTime), delay, localTime);
+    }
+  }
+
+  void addClockSample(s32 sample, u32 delay, u32 time) {  // (irq only)
+    auto& sync = clock.sync;
+
+    if (sync.samples == 0) {
+      sync.offset = sample;
+    } else {
+      s32 elapsed = time - clock.lastSampleTime;
+      if (elapsed > 0) {
+        s32 drift =
+            (s32)(((s64)(sample - clock.lastSample) * 1000000) / elapsed);
+        sync.drift += (drift - sync.drift) / 8;
+      }
+      sync.offset += (sample - sync.offset) / 4;
+    }
+
+    sync.delay = delay;
+    sync.samples++;
+    clock.lastSample = sample;
+    clock.lastSampleTime = time;
+  }
+
+  u32 buildClockSyncData(u8 type, u8 clientId, u32 payload) {  // (irq only)
+    MessageHeader header;
+    header.partialPacketId = (payload >> 16) & LINK_WIRELESS_PACKET_ID_MASK;
+    header.isConfirmation = true;
+    header.playerId = type;
+    header.clientCount = clientId - 1;
+    header.dataChecksum = buildChecksum(payload & 0xffff);
+
+    MessageHeaderSerializer serializer;
+    serializer.asStruct = header;
+    return buildU32(serializer.asInt, payload & 0xffff);
+  }
+
   void addIncomingMessagesFromData(CommandResult& result) {  // (irq only)
     for (u32 i = 1; i < result.responsesSize; i++) {
       u32 rawMessage = result.responses[i];
@@ -1046,6 +2310,19 @@ class LinkWireless {
       u32 checksum = header.dataChecksum;
       bool isPing = data == LINK_WIRELESS_MSG_PING;
 
+      if (isConfirmation && remotePlayerId == LINK_WIRELESS_MESSAGE_RUN) {
+        sessionState.timeouts[0] = 0;
+        if (state == CONNECTED && checksum == buildChecksum(data))
+          i = receiveMessageRun(result, i, header, data);
+        continue;
+      }
+      if (isConfirmation && remotePlayerId >= LINK_WIRELESS_MAX_PLAYERS) {
+        if (checksum == buildChecksum(data))
+          handleClockSyncData(remotePlayerId, header.clientCount,
+                              (partialPacketId << 16) | data);
+        continue;
+      }
+
       sessionState.timeouts[0] = 0;
       sessionState.timeouts[remotePlayerId] = 0;
 
@@ -1065,11 +2342,17 @@ class LinkWireless {
           continue;
       } else {
         sessionState.tmpMessagesToReceive.push(message);
+        forwardMessageIfNeeded(message);
       }
     }
     copyIncomingState();
   }
 
+  void forwardMessageIfNeeded(Message& message) {  // (irq only)
+    if (state == SERVING && config.forwarding && sessionState.playerCount > 2)
+      sessionState.forwardedMessages.push(message);
+  }
+
   bool acceptMessage(Message& message,
                      bool isConfirmation,
                      u32 remotePlayerCount) {  // (irq only)
@@ -1082,9 +2365,11 @@ class LinkWireless {
           message.packetId != expectedPacketId)
         return false;
 
-      if (!isConfirmation)
+      if (!isConfirmation) {
         message.packetId =
             ++sessionState.lastPacketIdFromClients[message.playerId];
+        sessionState.hasNewConfirmations = true;
+      }
     } else {
       u32 expectedPacketId = (sessionState.lastPacketIdFromServer + 1) %
                              LINK_WIRELESS_MAX_PACKET_IDS;
@@ -1157,6 +2442,9 @@ class LinkWireless {
           !sessionState.didReceiveLastPacketIdFromServer) {
         sessionState.lastPacketIdFromServer = confirmationData;
         sessionState.didReceiveLastPacketIdFromServer = true;
+      } else if (confirmation.playerId == sessionState.currentPlayerId &&
+                 sessionState.shouldResyncPacketIds) {
+        resyncPacketIds(confirmationData);
       } else if (confirmation.playerId == sessionState.currentPlayerId) {
         handleServerConfirmation(confirmationData);
       } else {
@@ -1169,6 +2457,27 @@ class LinkWireless {
     return true;
   }
 
+  void changeCurrentPlayerId(u8 playerId) {  // (irq only)
+    // the server's packet ids for the new slot belong to its previous owner,
+    // so pending messages are renumbered after its first confirmation
+    sessionState.currentPlayerId = playerId;
+    sessionState.lastConfirmationFromServer = 0;
+    sessionState.shouldResyncPacketIds = config.retransmission;
+    sessionState.outgoingMessages.forEach([playerId](Message& message) {
+      message.playerId = playerId;
+      return true;
+    });
+  }
+
+  void resyncPacketIds(u32 lastPacketIdFromSlot) {  // (irq only)
+    sessionState.lastPacketId = lastPacketIdFromSlot;
+    sessionState.outgoingMessages.forEach([this](Message& message) {
+      message.packetId = newPacketId();
+      return true;
+    });
+    sessionState.shouldResyncPacketIds = false;
+  }
+
   void handleServerConfirmation(u32 confirmationData) {  // (irq only)
     sessionState.lastConfirmationFromServer = confirmationData;
     removeConfirmedMessages(confirmationData);
@@ -1246,7 +2555,16 @@ class LinkWireless {
                             : LINK_WIRELESS_MAX_CLIENT_TRANSFER_LENGTH;
   }
 
-  void copyOutgoingState() {  // (irq only)
+  void copyOutgoingState() {  // (irq only)
+    while (!sessionState.forwardedMessages.isEmpty()) {
+      if (!_canSend())
+        return;
+
+      auto message = sessionState.forwardedMessages.pop();
+      message.packetId = newPacketId();
+      sessionState.outgoingMessages.push(message);
+    }
+
     if (isAddingMessage)
       return;
 
@@ -1255,6 +2573,7 @@ class LinkWireless {
         break;
 
       auto message = sessionState.tmpMessagesToSend.pop();
+      message.playerId = sessionState.currentPlayerId;
       message.packetId = newPacketId();
       sessionState.outgoingMessages.push(message);
     }
@@ -1264,12 +2583,99 @@ class LinkWireless {
     if (isReadingMessages)
       return;
 
+    // (each player gets a fair share of the queue, so a player that isn't
+    // being read can't make the others lose messages)
+    u32 maxMessagesPerPlayer =
+        LINK_WIRELESS_INCOMING_QUEUE_SIZE / max(config.maxPlayers - 1, 1);
+
     while (!sessionState.tmpMessagesToReceive.isEmpty()) {
       auto message = sessionState.tmpMessagesToReceive.pop();
-      sessionState.incomingMessages.push(message);
+      sessionState.incomingMessages.push(message, maxMessagesPerPlayer);
+    }
+  }
+
+  u32 parseServers(CommandResult& result, Server servers[]) {
+    u32 totalBroadcasts =
+        result.responsesSize / LINK_WIRELESS_BROADCAST_RESPONSE_LENGTH;
+    u32 totalServers = 0;
+
+    for (u32 i = 0; i < totalBroadcasts; i++) {
+      u32 start = LINK_WIRELESS_BROADCAST_RESPONSE_LENGTH * i;
+
+      u8 protocolTag = lsB16(msB32(result.responses[start + 4]));
+      if (protocolTag != LINK_WIRELESS_PROTOCOL_TAG)
+        continue;
+
+      Server server;
+      server.id = (u16)result.responses[start];
+      server.gameId = result.responses[start + 1] & LINK_WIRELESS_MAX_GAME_ID;
+      u32 gameI = 0, userI = 0;
+      recoverName(server.gameName, gameI, result.responses[start + 1], false);
+      recoverName(server.gameName, gameI, result.responses[start + 2]);
+      recoverName(server.gameName, gameI, result.responses[start + 3]);
+      recoverName(server.gameName, gameI, lsB32(result.responses[start + 4]));
+      recoverName(server.userName, userI, result.responses[start + 5]);
+      recoverName(server.userName, userI, result.responses[start + 6]);
+      server.sessionNonce = msB16(msB32(result.responses[start + 4]));
+      server.gameName[gameI] = '\0';
+      server.userName[userI] = '\0';
+      u8 connectedClients = (result.responses[start] >> 16) & 0xff;
+      server.currentPlayerCount =
+          connectedClients == 0xff ? 0 : (1 + connectedClients);
+      server.lastSeenFrame = frameCount;
+
+      servers[totalServers++] = server;
+    }
+    for (u32 i = totalServers; i < totalBroadcasts; i++)
+      servers[i] = Server{};
+
+    return totalServers;
+  }
+
+  template <typename F>
+  void updateServerCache(Server servers[], u32 totalServers, F onEvent) {
+    for (u32 i = 0; i < LINK_WIRELESS_MAX_SERVERS; i++) {
+      auto& cached = serverCache[i];
+      if (cached.id != LINK_WIRELESS_END &&
+          frameCount - cached.lastSeenFrame >
+              LINK_WIRELESS_SERVER_CACHE_TTL_FRAMES) {
+        onEvent(SERVER_DISAPPEARED, cached);
+        cached = Server{};
+      }
+    }
+
+    for (u32 i = 0; i < totalServers; i++) {
+      auto& server = servers[i];
+      u32 slot = 0;
+      bool isNew = true;
+
+      for (u32 j = 0; j < LINK_WIRELESS_MAX_SERVERS; j++) {
+        auto& cached = serverCache[j];
+        if (cached.id == server.id) {
+          slot = j;
+          isNew = false;
+          break;
+        }
+        if (cached.id == LINK_WIRELESS_END ||
+            (serverCache[slot].id != LINK_WIRELESS_END &&
+             cached.lastSeenFrame < serverCache[slot].lastSeenFrame))
+          slot = j;
+      }
+
+      if (isNew && serverCache[slot].id != LINK_WIRELESS_END)
+        onEvent(SERVER_DISAPPEARED, serverCache[slot]);
+      serverCache[slot] = server;
+      if (isNew)
+        onEvent(SERVER_APPEARED, server);
     }
   }
 
+  bool isTimerUsed(u8 timerId) {
+    return timerId == config.sendTimerId ||
+           (config.asyncACKTimerId > -1 &&
+            timerId == (u8)config.asyncACKTimerId);
+  }
+
   u32 newPacketId() {  // (irq only)
     return ++sessionState.lastPacketId;
   }
@@ -1281,17 +2687,6 @@ class LinkWireless {
     nextCommandDataSize++;
   }
 
-  void startACKTimer() {
-    REG_TM[config.asyncACKTimerId].start = -1;
-    REG_TM[config.asyncACKTimerId].cnt =
-        TM_ENABLE | TM_IRQ | LINK_WIRELESS_BASE_FREQUENCY;
-  }
-
-  void stopACKTimer() {
-    REG_TM[config.asyncACKTimerId].cnt =
-        REG_TM[config.asyncACKTimerId].cnt & (~TM_ENABLE);
-  }
-
   void copyName(char* target, const char* source, u32 length) {
     u32 len = std::strlen(source);
 
@@ -1329,54 +2724,110 @@ class LinkWireless {
     return start();
   }
 
+  void resetAsync(Error error) {  // (irq only)
+    if (config.resume && isSessionActive()) {
+      resumeAsync();
+    } else {
+      bool wasStarting = state == STARTING;
+
+      resetState();
+      stop();
+      if (!wasStarting)
+        startAsync();
+    }
+
+    lastError = error;
+  }
+
+  void resumeAsync() {  // (irq only)
+    resume.isServer = state == SERVING;
+    resume.shouldSearch = false;
+    resume.playerCount = sessionState.playerCount;
+    resume.acceptedPlayerCount = 1;
+    resume.startFrame = frameCount;
+
+    resetTransportState();
+    stop();
+    startAsync(true);
+  }
+
+  void finishResume(State newState) {  // (irq only)
+    if (newState == SERVING) {
+      // (clients may come back with other ids: their confirmations are taken
+      // again from scratch, and the slots that weren't taken are freed)
+      for (u32 i = 0; i < LINK_WIRELESS_MAX_PLAYERS; i++) {
+        sessionState.lastConfirmationFromClients[i] = 0;
+        if (i >= sessionState.playerCount)
+          sessionState.lastPacketIdFromClients[i] = 0;
+      }
+    }
+
+    resetTransportState();
+    startupFrames = frameCount - resume.startFrame;
+    state = newState;
+  }
+
   void resetState() {
     this->state = NEEDS_RESET;
     this->sessionState.playerCount = 1;
     this->sessionState.currentPlayerId = 0;
-    this->sessionState.recvTimeout = 0;
-    this->sessionState.frameRecvCount = 0;
-    this->sessionState.acceptCalled = false;
-    this->sessionState.pingSent = false;
-#ifdef LINK_WIRELESS_USE_SEND_RECEIVE_LATCH
-    this->sessionState.sendReceiveLatch = false;
-    this->sessionState.shouldWaitForServer = false;
-#endif
     this->sessionState.didReceiveLastPacketIdFromServer = false;
+    this->sessionState.shouldResyncPacketIds = false;
     this->sessionState.lastPacketId = 0;
     this->sessionState.lastPacketIdFromServer = 0;
     this->sessionState.lastConfirmationFromServer = 0;
     for (u32 i = 0; i < LINK_WIRELESS_MAX_PLAYERS; i++) {
-      this->sessionState.timeouts[i] = 0;
       this->sessionState.lastPacketIdFromClients[i] = 0;
       this->sessionState.lastConfirmationFromClients[i] = 0;
     }
-    this->asyncCommand.isActive = false;
-    this->nextCommandDataSize = 0;
+    this->clock.sync = ClockSync{};
+    for (u32 i = 0; i < LINK_WIRELESS_MAX_PLAYERS; i++)
+      this->sessionState.signalLevels[i] = 0;
+    resetTransportState();
 
     if (!isReadingMessages)
       this->sessionState.incomingMessages.clear();
     this->sessionState.outgoingMessages.clear();
 
     this->sessionState.tmpMessagesToReceive.clear();
+    this->sessionState.forwardedMessages.clear();
     if (!isAddingMessage)
       this->sessionState.tmpMessagesToSend.clear();
     else
       isPendingClearActive = true;
   }
 
+  void resetTransportState() {
+    this->sessionState.recvTimeout = 0;
+    this->sessionState.frameRecvCount = 0;
+    this->sessionState.acceptCalled = false;
+    this->sessionState.pingSent = false;
+    this->sessionState.shouldSampleSignal = false;
+    this->sessionState.isChaining = true;
+    this->sessionState.sendReceiveLatch = false;
+    this->sessionState.shouldWaitForServer = false;
+    for (u32 i = 0; i < LINK_WIRELESS_MAX_PLAYERS; i++) {
+      this->sessionState.timeouts[i] = 0;
+      this->clock.hasRequest[i] = false;
+    }
+    this->clock.isWaitingResponse = false;
+    this->clock.hasResponseHighPart = false;
+    this->asyncCommand.isActive = false;
+    this->pendingAsyncCommands.clear();
+    this->nextCommandDataSize = 0;
+  }
+
   void stop() {
     stopTimer();
-    if (usesAsyncACK())
-      stopACKTimer();
-
-    linkSPI->deactivate();
+    linkSPI.deactivate();
   }
 
   bool start() {
+    startup.startFrame = frameCount;
     startTimer();
 
     pingAdapter();
-    linkSPI->activate(LinkSPI::Mode::MASTER_256KBPS);
+    linkSPI.activate(LinkSPI::Mode::MASTER_256KBPS);
 
     if (!login())
       return false;
@@ -1389,12 +2840,144 @@ class LinkWireless {
     if (!setup())
       return false;
 
-    linkSPI->activate(LinkSPI::Mode::MASTER_2MBPS);
-    state = AUTHENTICATED;
+    finishStart();
 
     return true;
   }
 
+  void startAsync(bool isResuming = false) {
+    startup.step = StartupState::Step::PINGING;
+    startup.pendingTicks = linesToTicks(LINK_WIRELESS_PING_WAIT);
+    startup.loginStep = 0;
+    startup.loginMemory = LoginMemory{};
+    startup.isTransferring = false;
+    startup.startFrame = frameCount;
+    state = isResuming ? RESUMING : STARTING;
+
+    pingAdapterStart();
+    startTimer();
+  }
+
+  void continueStart() {  // (irq only)
+    if (startup.pendingTicks > 0 && --startup.pendingTicks > 0)
+      return;
+
+    switch (startup.step) {
+      case StartupState::Step::PINGING: {
+        pingAdapterEnd();
+        linkSPI.activate(LinkSPI::Mode::MASTER_256KBPS);
+
+        startup.step = StartupState::Step::LOGGING_IN;
+        startup.pendingTicks = linesToTicks(LINK_WIRELESS_TRANSFER_WAIT);
+        break;
+      }
+      case StartupState::Step::LOGGING_IN: {
+        if (!startup.isTransferring) {
+          startup.isTransferring = true;
+          linkSPI.transferAsync(buildLoginPacket(
+              getLoginPart(startup.loginStep), startup.loginMemory));
+        }
+        break;
+      }
+      case StartupState::Step::HELLO: {
+        // Hello (start)
+        if (!asyncCommand.isActive)
+          sendCommandAsync(LINK_WIRELESS_COMMAND_HELLO);
+        break;
+      }
+      case StartupState::Step::ACCEPT: {
+        // AcceptConnections (start)
+        if (!asyncCommand.isActive)
+          sendCommandAsync(LINK_WIRELESS_COMMAND_ACCEPT_CONNECTIONS);
+        break;
+      }
+      case StartupState::Step::CHECK_CONNECTION: {
+        // IsFinishedConnect (start)
+        if (!asyncCommand.isActive)
+          sendCommandAsync(LINK_WIRELESS_COMMAND_IS_FINISHED_CONNECT);
+        break;
+      }
+      case StartupState::Step::SEARCH_POLL: {
+        // BroadcastReadPoll (start)
+        if (!asyncCommand.isActive)
+          sendCommandAsync(LINK_WIRELESS_COMMAND_BROADCAST_READ_POLL);
+        break;
+      }
+      default: {
+      }
+    }
+  }
+
+  void processLoginResponse(u32 response) {  // (irq only)
+    u16 data = getLoginPart(startup.loginStep);
+    u16 expectedResponse = startup.loginStep == 0 ? 0 : data;
+    startup.isTransferring = false;
+
+    if (!acceptLoginResponse(response, data, expectedResponse,
+                             startup.loginMemory)) {
+      resetAsync(COMMAND_FAILED);
+      return;
+    }
+
+    startup.loginStep++;
+    if (startup.loginStep > LINK_WIRELESS_LOGIN_STEPS)
+      startup.step = StartupState::Step::HELLO;
+    startup.pendingTicks = linesToTicks(LINK_WIRELESS_TRANSFER_WAIT);
+  }
+
+  void finishStart() {
+    linkSPI.activate(LinkSPI::Mode::MASTER_2MBPS);
+
+    if (state == RESUMING) {
+      continueResume();
+      return;
+    }
+
+    startupFrames = frameCount - startup.startFrame;
+    state = AUTHENTICATED;
+  }
+
+  void continueResume() {  // (irq only)
+    if (resume.isServer) {
+      // Broadcast (start)
+      startup.step = StartupState::Step::BROADCAST;
+      for (u32 i = 0; i < LINK_WIRELESS_BROADCAST_LENGTH; i++)
+        addData(resume.broadcastData[i], i == 0);
+      sendCommandAsync(LINK_WIRELESS_COMMAND_BROADCAST, true);
+    } else if (resume.shouldSearch) {
+      // BroadcastReadStart (start)
+      startup.step = StartupState::Step::SEARCH_START;
+      sendCommandAsync(LINK_WIRELESS_COMMAND_BROADCAST_READ_START);
+    } else {
+      connectAsync();
+    }
+  }
+
+  void connectAsync() {  // (irq only)
+    // Connect (start)
+    startup.step = StartupState::Step::CONNECT;
+    addData(resume.serverId, true);
+    sendCommandAsync(LINK_WIRELESS_COMMAND_CONNECT, true);
+  }
+
+  bool isSameRoom(Server& server, Server& other) {
+    return server.gameId == other.gameId &&
+           server.sessionNonce == other.sessionNonce &&
+           std::strcmp(server.gameName, other.gameName) == 0 &&
+           std::strcmp(server.userName, other.userName) == 0;
+  }
+
+  bool isStartingAdapter() { return state == STARTING || state == RESUMING; }
+
+  u32 linesToTicks(u32 verticalLines) {
+    u32 cyclesPerTick = config.interval * LINK_WIRELESS_CYCLES_PER_TICK;
+
+    // (+1 because the wait can start in the middle of a tick)
+    return (verticalLines * LINK_WIRELESS_CYCLES_PER_LINE + cyclesPerTick - 1) /
+               cyclesPerTick +
+           1;
+  }
+
   void stopTimer() {
     REG_TM[config.sendTimerId].cnt =
         REG_TM[config.sendTimerId].cnt & (~TM_ENABLE);
@@ -1407,13 +2990,19 @@ class LinkWireless {
   }
 
   void pingAdapter() {
-    linkGPIO->setMode(LinkGPIO::Pin::SO, LinkGPIO::Direction::OUTPUT);
-    linkGPIO->setMode(LinkGPIO::Pin::SD, LinkGPIO::Direction::OUTPUT);
-    linkGPIO->writePin(LinkGPIO::SD, true);
+    pingAdapterStart();
     wait(LINK_WIRELESS_PING_WAIT);
-    linkGPIO->writePin(LinkGPIO::SD, false);
+    pingAdapterEnd();
+  }
+
+  void pingAdapterStart() {
+    linkGPIO.setMode(LinkGPIO::Pin::SO, LinkGPIO::Direction::OUTPUT);
+    linkGPIO.setMode(LinkGPIO::Pin::SD, LinkGPIO::Direction::OUTPUT);
+    linkGPIO.writePin(LinkGPIO::SD, true);
   }
 
+  void pingAdapterEnd() { linkGPIO.writePin(LinkGPIO::SD, false); }
+
   bool login() {
     LoginMemory memory;
 
@@ -1432,9 +3021,19 @@ class LinkWireless {
   bool exchangeLoginPacket(u16 data,
                            u16 expectedResponse,
                            LoginMemory& memory) {
-    u32 packet = buildU32(~memory.previousAdapterData, data);
-    u32 response = transfer(packet, false);
+    u32 response = transfer(buildLoginPacket(data, memory), false);
+
+    return acceptLoginResponse(response, data, expectedResponse, memory);
+  }
 
+  u32 buildLoginPacket(u16 data, LoginMemory& memory) {
+    return buildU32(~memory.previousAdapterData, data);
+  }
+
+  bool acceptLoginResponse(u32 response,
+                           u16 data,
+                           u16 expectedResponse,
+                           LoginMemory& memory) {
     if (msB32(response) != expectedResponse ||
         lsB32(response) != (u16)~memory.previousGBAData)
       return false;
@@ -1445,12 +3044,20 @@ class LinkWireless {
     return true;
   }
 
+  u16 getLoginPart(u32 loginStep) {
+    return LINK_WIRELESS_LOGIN_PARTS[loginStep == 0 ? 0 : loginStep - 1];
+  }
+
   bool setup(u8 maxPlayers = LINK_WIRELESS_MAX_PLAYERS) {
+    addSetupData(maxPlayers);
+    return sendCommand(LINK_WIRELESS_COMMAND_SETUP, true).success;
+  }
+
+  void addSetupData(u8 maxPlayers = LINK_WIRELESS_MAX_PLAYERS) {
     addData(LINK_WIRELESS_SETUP_MAGIC |
                 (((LINK_WIRELESS_MAX_PLAYERS - maxPlayers) & 0b11)
                  << LINK_WIRELESS_SETUP_MAX_PLAYERS_BIT),
             true);
-    return sendCommand(LINK_WIRELESS_COMMAND_SETUP, true).success;
   }
 
   CommandResult sendCommand(u8 type, bool withData = false) {
@@ -1495,18 +3102,26 @@ class LinkWireless {
       for (u32 i = 0; i < nextCommandDataSize; i++)
         asyncCommand.parameters[i] = nextCommandData[i];
     }
+    asyncCommand.totalParameters = withData ? nextCommandDataSize : 0;
+    asyncCommand.retries = 0;
+    asyncCommand.retryTicks = 0;
+    asyncCommand.isActive = true;
+
+    startAsyncCommand();
+  }
+
+  void startAsyncCommand() {  // (irq only)
     asyncCommand.result.success = false;
     asyncCommand.state = AsyncCommand::State::PENDING;
     asyncCommand.step = AsyncCommand::Step::COMMAND_HEADER;
     asyncCommand.sentParameters = 0;
-    asyncCommand.totalParameters = withData ? nextCommandDataSize : 0;
     asyncCommand.receivedResponses = 0;
     asyncCommand.totalResponses = 0;
     asyncCommand.pendingData = 0;
-    asyncCommand.ackStep = AsyncCommand::ACKStep::READY;
-    asyncCommand.isActive = true;
+    asyncCommand.remoteCommandId = 0;
+    asyncCommand.startTime = profileStart();
 
-    u32 command = buildCommand(type, asyncCommand.totalParameters);
+    u32 command = buildCommand(asyncCommand.type, asyncCommand.totalParameters);
     transferAsync(command);
   }
 
@@ -1556,6 +3171,8 @@ class LinkWireless {
         receiveAsyncCommandResponseOrFinish();
         break;
       }
+      default: {
+      }
     }
   }
 
@@ -1580,12 +3197,118 @@ class LinkWireless {
     }
   }
 
+  bool isWaitingForAdapter() {
+    return asyncCommand.isActive &&
+           asyncCommand.type == LINK_WIRELESS_COMMAND_SEND_DATA_AND_WAIT &&
+           asyncCommand.step >= AsyncCommand::Step::RESPONSE_REQUEST;
+  }
+
+  void processAdapterTransfer(u32 newData) {  // (irq only)
+    switch (asyncCommand.step) {
+      case AsyncCommand::Step::RESPONSE_REQUEST: {
+        u16 header = msB32(newData);
+        u8 ack = lsB16(lsB32(newData));
+
+        if (header != LINK_WIRELESS_COMMAND_HEADER ||
+            ack != asyncCommand.type + LINK_WIRELESS_RESPONSE_ACK) {
+          finishAdapterWait(false);
+          return;
+        }
+
+        startHandshake(LinkSPI::HandshakeType::REVERSE_ACKNOWLEDGE_START,
+                       newData);
+        break;
+      }
+      case AsyncCommand::Step::REMOTE_COMMAND:
+      case AsyncCommand::Step::REMOTE_PARAMETERS: {
+        startHandshake(LinkSPI::HandshakeType::REVERSE_ACKNOWLEDGE, newData);
+        break;
+      }
+      case AsyncCommand::Step::REMOTE_ACK: {
+        startHandshake(LinkSPI::HandshakeType::REVERSE_ACKNOWLEDGE_LAST,
+                       newData);
+        break;
+      }
+      default: {
+      }
+    }
+  }
+
+  void continueAdapterTransfer(u32 newData, bool success) {  // (irq only)
+    if (!success) {
+      finishAdapterWait(false);
+      return;
+    }
+
+    switch (asyncCommand.step) {
+      case AsyncCommand::Step::RESPONSE_REQUEST: {
+        // (the adapter controls the clock until it sends a command)
+        linkSPI.activate(LinkSPI::Mode::SLAVE);
+        asyncCommand.step = AsyncCommand::Step::REMOTE_COMMAND;
+        transferAsync(LINK_WIRELESS_DATA_REQUEST);
+        break;
+      }
+      case AsyncCommand::Step::REMOTE_COMMAND: {
+        u16 header = msB32(newData);
+        u16 data = lsB32(newData);
+        u8 params = msB16(data);
+
+        if (header != LINK_WIRELESS_COMMAND_HEADER ||
+            params > LINK_WIRELESS_MAX_COMMAND_RESPONSE_LENGTH) {
+          finishAdapterWait(false);
+          return;
+        }
+
+        asyncCommand.remoteCommandId = lsB16(data);
+        asyncCommand.totalResponses = params;
+        asyncCommand.result.responsesSize = params;
+
+        receiveRemoteParameterOrAcknowledge();
+        break;
+      }
+      case AsyncCommand::Step::REMOTE_PARAMETERS: {
+        asyncCommand.result.responses[asyncCommand.receivedResponses] = newData;
+        asyncCommand.receivedResponses++;
+
+        receiveRemoteParameterOrAcknowledge();
+        break;
+      }
+      case AsyncCommand::Step::REMOTE_ACK: {
+        finishAdapterWait(newData == LINK_WIRELESS_DATA_REQUEST);
+        break;
+      }
+      default: {
+      }
+    }
+  }
+
+  void receiveRemoteParameterOrAcknowledge() {  // (irq only)
+    if (asyncCommand.receivedResponses < asyncCommand.totalResponses) {
+      asyncCommand.step = AsyncCommand::Step::REMOTE_PARAMETERS;
+      transferAsync(LINK_WIRELESS_DATA_REQUEST);
+    } else {
+      asyncCommand.step = AsyncCommand::Step::REMOTE_ACK;
+      transferAsync(buildU32(
+          LINK_WIRELESS_COMMAND_HEADER,
+          (asyncCommand.remoteCommandId + LINK_WIRELESS_RESPONSE_ACK) & 0xff));
+    }
+  }
+
+  void finishAdapterWait(bool success) {  // (irq only)
+    // (the next command is sent on the next timer tick, which is enough time
+    // for the adapter to be ready again)
+    linkSPI.activate(LinkSPI::Mode::MASTER_2MBPS);
+    asyncCommand.result.success = success;
+    asyncCommand.state = AsyncCommand::State::COMPLETED;
+    processAsyncCommand();
+  }
+
   u32 buildCommand(u8 type, u8 length = 0) {
     return buildU32(LINK_WIRELESS_COMMAND_HEADER, buildU16(length, type));
   }
 
   void transferAsync(u32 data) {
-    linkSPI->transfer(
+    linkSPI.transfer(
         data, []() { return false; }, true, true);
   }
 
@@ -1595,35 +3318,19 @@ class LinkWireless {
 
     u32 lines = 0;
     u32 vCount = REG_VCOUNT;
-    u32 receivedData = linkSPI->transfer(
+    u32 receivedData = linkSPI.transfer(
         data, [this, &lines, &vCount]() { return cmdTimeout(lines, vCount); },
         false, customAck);
 
-    if (customAck && !acknowledge())
+    // (synchronous commands never run inside interrupt handlers)
+    if (customAck && !linkSPI.handshake(LinkSPI::HandshakeType::ACKNOWLEDGE,
+                                        config.asyncACKTimerId,
+                                        LINK_WIRELESS_CMD_TIMEOUT, true))
       return LINK_SPI_NO_DATA;
 
     return receivedData;
   }
 
-  bool acknowledge() {
-    u32 lines = 0;
-    u32 vCount = REG_VCOUNT;
-
-    linkSPI->_setSOLow();
-    while (!linkSPI->_isSIHigh())
-      if (cmdTimeout(lines, vCount))
-        return false;
-    linkSPI->_setSOHigh();
-    while (linkSPI->_isSIHigh())
-      if (cmdTimeout(lines, vCount))
-        return false;
-    linkSPI->_setSOLow();
-
-    return true;
-  }
-
-  bool usesAsyncACK() { return config.asyncACKTimerId > -1; }
-
   bool cmdTimeout(u32& lines, u32& vCount) {
     return timeout(LINK_WIRELESS_CMD_TIMEOUT, lines, vCount);
   }
@@ -1673,32 +3380,55 @@ class LinkWireless {
   u8 msB16(u16 value) { return value >> 8; }
   u8 lsB16(u16 value) { return value & 0xff; }
 
-#ifdef PROFILING_ENABLED
-  void profileStart() {
-    REG_TM1CNT_L = 0;
-    REG_TM2CNT_L = 0;
+  void profileAsyncCommand() {  // (irq only)
+    if (profilerTimerId == -1)
+      return;
+
+    u32 cycles = readProfilerTimer() - asyncCommand.startTime;
 
-    REG_TM1CNT_H = 0;
-    REG_TM2CNT_H = 0;
+    switch (asyncCommand.type) {
+      case LINK_WIRELESS_COMMAND_SEND_DATA:
+      case LINK_WIRELESS_COMMAND_SEND_DATA_AND_WAIT: {
+        profiler.sendData.add(cycles);
+        break;
+      }
+      case LINK_WIRELESS_COMMAND_RECEIVE_DATA: {
+        profiler.receiveData.add(cycles);
+        break;
+      }
+      case LINK_WIRELESS_COMMAND_ACCEPT_CONNECTIONS: {
+        profiler.acceptConnections.add(cycles);
+        break;
+      }
+      default: {
+      }
+    }
+  }
 
-    REG_TM2CNT_H = TM_ENABLE | TM_CASCADE;
-    REG_TM1CNT_H = TM_ENABLE | TM_FREQ_1;
+  u32 profileStart() {  // (irq only)
+    return profilerTimerId > -1 ? readProfilerTimer() : 0;
   }
 
-  u32 profileStop() {
-    REG_TM1CNT_H = 0;
-    REG_TM2CNT_H = 0;
+  void profileStop(ProfilerStats& stats, u32 startTime) {  // (irq only)
+    if (profilerTimerId == -1)
+      return;
 
-    return (REG_TM1CNT_L | (REG_TM2CNT_L << 16));
+    u32 cycles = readProfilerTimer() - startTime;
+    stats.add(cycles);
+    profiler.currentFrameCycles += cycles;
   }
 
- public:
-  u32 toMs(u32 cycles) {
-    // CPU Frequency * time per frame = cycles per frame
-    // 16780000 * (1/60) ~= 279666
-    return (cycles * 1000) / (279666 * 60);
+  u32 readProfilerTimer() {  // (irq only)
+    u16 high = REG_TM[profilerTimerId + 1].count;
+    u16 low = REG_TM[profilerTimerId].count;
+    u16 newHigh = REG_TM[profilerTimerId + 1].count;
+
+    // (the low counter overflowed between reads)
+    if (newHigh != high)
+      low = REG_TM[profilerTimerId].count;
+
+    return (newHigh << 16) | low;
   }
-#endif
 };
 
 extern LinkWireless* linkWireless;